@@ -0,0 +1,147 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "bpf.h"
+
+// Upper bound on the number of CPUs that have their own counter in the packed and padded arrays.
+#if !defined(MAX_CPUS)
+#define MAX_CPUS 1024
+#endif
+
+// Two cache lines, so that a padded counter never shares a line with another CPU's counter, whatever the alignment
+// of the array values, and isn't pulled in by the adjacent line prefetcher either.
+#define PADDED_COUNTER_SIZE 128
+
+// A single counter shared by all CPUs.
+struct
+{
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, int);
+    __type(value, unsigned long long);
+    __uint(max_entries, 1);
+} shared_counter_map SEC(".maps");
+
+// A counter per CPU, kept apart by the map.
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, int);
+    __type(value, unsigned long long);
+    __uint(max_entries, 1);
+} percpu_counter_map SEC(".maps");
+
+// A counter per CPU, indexed by CPU number, with 8 counters to a cache line.
+struct
+{
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, int);
+    __type(value, unsigned long long);
+    __uint(max_entries, MAX_CPUS);
+} packed_counter_map SEC(".maps");
+
+struct padded_counter
+{
+    unsigned long long count;
+    unsigned char padding[PADDED_COUNTER_SIZE - sizeof(unsigned long long)];
+};
+
+// A counter per CPU, indexed by CPU number, each on cache lines of its own.
+struct
+{
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, int);
+    __type(value, struct padded_counter);
+    __uint(max_entries, MAX_CPUS);
+} padded_counter_map SEC(".maps");
+
+// Atomically increment the shared counter, which bounces its cache line between the CPUs.
+SEC("sockops/shared_atomic_increment") int shared_atomic_increment(void* ctx)
+{
+    int key = 0;
+    unsigned long long* count = bpf_map_lookup_elem(&shared_counter_map, &key);
+    if (!count) {
+        return 1;
+    }
+    __sync_fetch_and_add(count, 1);
+    return 0;
+}
+
+// Increment the shared counter without synchronization, which loses updates but still bounces the cache line.
+SEC("sockops/shared_racy_increment") int shared_racy_increment(void* ctx)
+{
+    int key = 0;
+    volatile unsigned long long* count = bpf_map_lookup_elem(&shared_counter_map, &key);
+    if (!count) {
+        return 1;
+    }
+    *count = *count + 1;
+    return 0;
+}
+
+// Increment the counter of the current CPU in the per CPU array.
+SEC("sockops/percpu_increment") int percpu_increment(void* ctx)
+{
+    int key = 0;
+    unsigned long long* count = bpf_map_lookup_elem(&percpu_counter_map, &key);
+    if (!count) {
+        return 1;
+    }
+    *count += 1;
+    return 0;
+}
+
+// Increment the counter of the current CPU, which shares its cache line with the counters of other CPUs.
+SEC("sockops/packed_increment") int packed_increment(void* ctx)
+{
+    int key = bpf_get_smp_processor_id();
+    volatile unsigned long long* count = bpf_map_lookup_elem(&packed_counter_map, &key);
+    if (!count) {
+        return 1;
+    }
+    *count = *count + 1;
+    return 0;
+}
+
+// Increment the counter of the current CPU, which is on cache lines of its own.
+SEC("sockops/padded_increment") int padded_increment(void* ctx)
+{
+    int key = bpf_get_smp_processor_id();
+    volatile struct padded_counter* counter = bpf_map_lookup_elem(&padded_counter_map, &key);
+    if (!counter) {
+        return 1;
+    }
+    counter->count = counter->count + 1;
+    return 0;
+}
+
+// bpf_spin_lock is only supported on Linux.
+#if defined(PLATFORM_LINUX)
+struct locked_counter
+{
+    struct bpf_spin_lock lock;
+    unsigned long long count;
+};
+
+// A single counter shared by all CPUs, protected by a spin lock.
+struct
+{
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, int);
+    __type(value, struct locked_counter);
+    __uint(max_entries, 1);
+} locked_counter_map SEC(".maps");
+
+// Increment the shared counter while holding its spin lock.
+SEC("sockops/shared_spin_lock_increment") int shared_spin_lock_increment(void* ctx)
+{
+    int key = 0;
+    struct locked_counter* counter = bpf_map_lookup_elem(&locked_counter_map, &key);
+    if (!counter) {
+        return 1;
+    }
+    bpf_spin_lock(&counter->lock);
+    counter->count++;
+    bpf_spin_unlock(&counter->lock);
+    return 0;
+}
+#endif
@@ -0,0 +1,24 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#if defined(RESIZABLE)
+// Number of entries the test programs spread their keys over. It defaults to MAX_ENTRIES, but is a read-only global
+// so that a test can resize the maps at load time (see the maps and globals fields of a test) without building
+// another object. Only the resizable_* objects use it, so that the results of the existing tests stay comparable.
+volatile const unsigned int entry_count = MAX_ENTRIES;
+
+// Return a random index in [0, entry_count). The range is reduced with a multiply and shift rather than a modulo, as
+// entry_count isn't a compile-time constant.
+static inline unsigned int
+random_entry_index()
+{
+    return (unsigned int)(((unsigned long long)bpf_get_prandom_u32() * entry_count) >> 32);
+}
+#else
+#define entry_count MAX_ENTRIES
+
+// Return a random index in [0, MAX_ENTRIES).
+#define random_entry_index() (bpf_get_prandom_u32() % MAX_ENTRIES)
+#endif
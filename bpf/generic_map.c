@@ -11,6 +11,79 @@
 #define TYPE BPF_MAP_TYPE_HASH
 #endif
 
+#include "entry_count.h"
+#define RANDOM_KEY() random_entry_index()
+#include "key_table.h"
+#include "latency_histogram.h"
+
+#if defined(SIZED)
+// Largest key and value the sized variants support. Hash maps don't accept keys larger than the BPF stack.
+#define MAX_KEY_SIZE 512
+#define MAX_VALUE_SIZE 4096
+
+// The key and value sizes of the sized variants are set by the test at load time (see the maps field of a test), so
+// the map has no BTF key or value type. The key and value hold the key as an int followed by zeros, which matches the
+// sequential generator of the map state preparation.
+struct
+{
+    __uint(type, TYPE);
+    __uint(max_entries, MAX_ENTRIES);
+    __uint(key_size, sizeof(int));
+    __uint(value_size, sizeof(int));
+} map SEC(".maps");
+
+// Per CPU buffers for the key and value, as they can be larger than the BPF stack.
+struct sized_buffers
+{
+    unsigned char key[MAX_KEY_SIZE];
+    unsigned char value[MAX_VALUE_SIZE];
+};
+
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, unsigned int);
+    __type(value, struct sized_buffers);
+} buffers_map SEC(".maps");
+
+static inline struct sized_buffers*
+get_buffers(int key)
+{
+    unsigned int zero = 0;
+    struct sized_buffers* buffers = bpf_map_lookup_elem(&buffers_map, &zero);
+    if (buffers) {
+        *(int*)buffers->key = key;
+        *(int*)buffers->value = key;
+    }
+    return buffers;
+}
+
+static inline void*
+map_lookup(int key)
+{
+    struct sized_buffers* buffers = get_buffers(key);
+    return buffers ? bpf_map_lookup_elem(&map, buffers->key) : 0;
+}
+
+static inline void
+map_update(int key)
+{
+    struct sized_buffers* buffers = get_buffers(key);
+    if (buffers) {
+        bpf_map_update_elem(&map, buffers->key, buffers->value, BPF_ANY);
+    }
+}
+
+static inline void
+map_delete(int key)
+{
+    struct sized_buffers* buffers = get_buffers(key);
+    if (buffers) {
+        (void)bpf_map_delete_elem(&map, buffers->key);
+    }
+}
+#else
 struct
 {
     __uint(type, TYPE);
@@ -19,6 +92,25 @@ struct
     __type(value, int);
 } map SEC(".maps");
 
+static inline void*
+map_lookup(int key)
+{
+    return bpf_map_lookup_elem(&map, &key);
+}
+
+static inline void
+map_update(int key)
+{
+    bpf_map_update_elem(&map, &key, &key, BPF_ANY);
+}
+
+static inline void
+map_delete(int key)
+{
+    (void)bpf_map_delete_elem(&map, &key);
+}
+#endif
+
 struct
 {
     __uint(type, BPF_MAP_TYPE_ARRAY);
@@ -31,35 +123,97 @@ SEC("sockops/prepare") int prepare(void* ctx)
 {
     int key = 0;
     int* value = bpf_map_lookup_elem(&map_init, &key);
-    if (value && *value < MAX_ENTRIES) {
+    if (value && *value < entry_count) {
         int i = *value;
-        bpf_map_update_elem(&map, &i, &i, BPF_ANY);
+        map_update(i);
         *value += 1;
     }
     return 0;
 }
 
-SEC("sockops/read") int read(void* ctx)
+TIMED_PROGRAM(read)
 {
-    int key = bpf_get_prandom_u32() % MAX_ENTRIES;
-    int* value = bpf_map_lookup_elem(&map, &key);
+    int key = random_entry_index();
+    void* value = map_lookup(key);
     if (value) {
         return 0;
     }
     return 1;
 }
 
-SEC("sockops/update") int update(void* ctx)
+TIMED_PROGRAM(update)
 {
-    int key = bpf_get_prandom_u32() % MAX_ENTRIES;
-    bpf_map_update_elem(&map, &key, &key, BPF_ANY);
+    int key = random_entry_index();
+    map_update(key);
     return 0;
 }
 
-SEC("sockops/replace") int replace(void* ctx)
+TIMED_PROGRAM(replace)
 {
-    int key = bpf_get_prandom_u32() % MAX_ENTRIES;
-    (void)bpf_map_delete_elem(&map, &key);
-    (void)bpf_map_update_elem(&map, &key, &key, BPF_ANY);
+    int key = random_entry_index();
+    map_delete(key);
+    map_update(key);
+    return 0;
+}
+
+// Variants of the tests above that take their keys from the key table, which holds keys drawn from the
+// key_distribution of the test. Misses are expected with some distributions, so read doesn't fail on them.
+TIMED_PROGRAM(read_key_table)
+{
+    int key = next_table_key();
+    (void)map_lookup(key);
+    return 0;
+}
+
+TIMED_PROGRAM(update_key_table)
+{
+    int key = next_table_key();
+    map_update(key);
+    return 0;
+}
+
+TIMED_PROGRAM(replace_key_table)
+{
+    int key = next_table_key();
+    map_delete(key);
+    map_update(key);
+    return 0;
+}
+
+// Operations of the mixed test, precomputed by the runner from the operation_mix of the test in the same order as the
+// names of the operations in the runner. Each CPU walks its stream in step with its keys, so the runner resizes it
+// along with the key table.
+#define OPERATION_LOOKUP 0
+#define OPERATION_UPDATE 1
+#define OPERATION_DELETE 2
+
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, KEY_TABLE_SIZE);
+    __type(key, unsigned int);
+    __type(value, unsigned int);
+} operation_table SEC(".maps");
+
+// Interleave lookups, updates and deletes on every CPU, so that readers and writers share the same CPUs.
+TIMED_PROGRAM(mixed_key_table)
+{
+    unsigned int index = next_table_index();
+    int key = table_key_at(index);
+    unsigned int* operation = bpf_map_lookup_elem(&operation_table, &index);
+    if (!operation) {
+        return 1;
+    }
+    switch (*operation) {
+    case OPERATION_LOOKUP:
+        (void)map_lookup(key);
+        break;
+    case OPERATION_UPDATE:
+        map_update(key);
+        break;
+    case OPERATION_DELETE:
+        map_delete(key);
+        break;
+    }
     return 0;
 }
@@ -0,0 +1,85 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+// Number of keys in the stream of each CPU, unless the runner resizes the key table. Must be a power of 2.
+#if !defined(KEY_TABLE_SIZE)
+#define KEY_TABLE_SIZE 16384
+#endif
+
+#if defined(PLATFORM_LINUX)
+// Mask that wraps the cursor of each CPU around its stream. On Linux the runner sizes the key table to the number of
+// keys of the test when it loads the object, as a stream shorter than the key range would only ever access some of the
+// keys, and sets the mask to the new size minus one.
+volatile const unsigned int key_table_mask = KEY_TABLE_SIZE - 1;
+#else
+#define key_table_mask (KEY_TABLE_SIZE - 1)
+#endif
+
+// Keys precomputed by the runner from the key_distribution of a test, with one stream of keys per CPU.
+// Each CPU walks its stream with its own cursor, so fetching a key costs the same regardless of the distribution.
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, KEY_TABLE_SIZE);
+    __type(key, unsigned int);
+    __type(value, unsigned int);
+} key_table SEC(".maps");
+
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, unsigned int);
+    __type(value, unsigned int);
+} key_table_cursor SEC(".maps");
+
+// Advance the cursor of the current CPU, returning the index of the next entry of its stream.
+static inline unsigned int
+next_table_index()
+{
+    unsigned int zero = 0;
+    unsigned int* cursor = bpf_map_lookup_elem(&key_table_cursor, &zero);
+    if (!cursor) {
+        return 0;
+    }
+    unsigned int index = *cursor & key_table_mask;
+    *cursor += 1;
+    return index;
+}
+
+// Return the key at the given index of the stream of the current CPU.
+static inline unsigned int
+table_key_at(unsigned int index)
+{
+    unsigned int* key = bpf_map_lookup_elem(&key_table, &index);
+    return key ? *key : 0;
+}
+
+// Return the next key from the stream of the current CPU.
+static inline unsigned int
+next_table_key()
+{
+    return table_key_at(next_table_index());
+}
+
+// Expression that the programs of the object which don't use the key table generate their keys with, such as
+// bpf_get_prandom_u32() % MAX_ENTRIES. Defined by the object before including this file.
+#if !defined(RANDOM_KEY)
+#error "RANDOM_KEY() must be defined before including key_table.h"
+#endif
+
+// Cost of generating a key as the programs that don't use the key table do. The key is returned so that it can't be
+// optimized away. The runner reports the difference with table_key as the overhead removed from tests that use the
+// key table.
+SEC("sockops/random_key") int random_key(void* ctx)
+{
+    return RANDOM_KEY();
+}
+
+// Cost of fetching a key from the key table.
+SEC("sockops/table_key") int table_key(void* ctx)
+{
+    return next_table_key() == 0xFFFFFFFF;
+}
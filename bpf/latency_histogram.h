@@ -0,0 +1,90 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+// Programs declared with TIMED_PROGRAM(name) are built as is, or, when LATENCY_HISTOGRAM is defined, with their body
+// bracketed by bpf_ktime_get_ns and the elapsed time recorded in the per CPU latency_histogram_map. The runner merges
+// the histograms of all CPUs into the percentiles of the latency of the body (see the latency_histogram field).
+//
+// The histogram is log-linear: latencies below 2^LATENCY_HISTOGRAM_LINEAR_BITS ns have a bucket each, and every
+// power of 2 above that is split into 2^LATENCY_HISTOGRAM_LINEAR_BITS buckets, up to 2^LATENCY_HISTOGRAM_MAX_EXPONENT
+// ns. The layout must match runner/latency_histogram.h.
+#define LATENCY_HISTOGRAM_LINEAR_BITS 4
+#define LATENCY_HISTOGRAM_MAX_EXPONENT 40
+#define LATENCY_HISTOGRAM_BUCKET_COUNT \
+    ((LATENCY_HISTOGRAM_MAX_EXPONENT - LATENCY_HISTOGRAM_LINEAR_BITS + 1) << LATENCY_HISTOGRAM_LINEAR_BITS)
+
+#if defined(LATENCY_HISTOGRAM)
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, LATENCY_HISTOGRAM_BUCKET_COUNT);
+    __type(key, unsigned int);
+    __type(value, unsigned long long);
+} latency_histogram_map SEC(".maps");
+
+// Return the index of the most significant bit of a non-zero value.
+static inline unsigned int
+most_significant_bit(unsigned long long value)
+{
+    unsigned int bit = 0;
+    if (value >> 32) {
+        value >>= 32;
+        bit += 32;
+    }
+    if (value >> 16) {
+        value >>= 16;
+        bit += 16;
+    }
+    if (value >> 8) {
+        value >>= 8;
+        bit += 8;
+    }
+    if (value >> 4) {
+        value >>= 4;
+        bit += 4;
+    }
+    if (value >> 2) {
+        value >>= 2;
+        bit += 2;
+    }
+    if (value >> 1) {
+        bit += 1;
+    }
+    return bit;
+}
+
+static inline void
+record_latency(unsigned long long latency)
+{
+    unsigned int index;
+    if (latency >> LATENCY_HISTOGRAM_MAX_EXPONENT) {
+        index = LATENCY_HISTOGRAM_BUCKET_COUNT - 1;
+    } else if (latency >> LATENCY_HISTOGRAM_LINEAR_BITS) {
+        unsigned int exponent = most_significant_bit(latency);
+        unsigned int shift = exponent - LATENCY_HISTOGRAM_LINEAR_BITS;
+        index = ((exponent - LATENCY_HISTOGRAM_LINEAR_BITS + 1) << LATENCY_HISTOGRAM_LINEAR_BITS) +
+                ((latency >> shift) & ((1 << LATENCY_HISTOGRAM_LINEAR_BITS) - 1));
+    } else {
+        index = (unsigned int)latency;
+    }
+    unsigned long long* count = bpf_map_lookup_elem(&latency_histogram_map, &index);
+    if (count) {
+        *count += 1;
+    }
+}
+
+#define TIMED_PROGRAM(name)                                    \
+    static inline int name##_body(void* ctx);                  \
+    SEC("sockops/" #name) int name(void* ctx)                  \
+    {                                                          \
+        unsigned long long start = bpf_ktime_get_ns();         \
+        int result = name##_body(ctx);                         \
+        record_latency(bpf_ktime_get_ns() - start);            \
+        return result;                                         \
+    }                                                          \
+    static inline int name##_body(void* ctx)
+#else
+#define TIMED_PROGRAM(name) SEC("sockops/" #name) int name(void* ctx)
+#endif
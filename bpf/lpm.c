@@ -8,6 +8,13 @@
 #define MAX_ENTRIES 1024
 #endif
 
+#include "entry_count.h"
+// The read program also draws the host part of the address with a second call to bpf_get_prandom_u32, which is
+// measured by its own random_key_read and table_key_read programs below.
+#define RANDOM_KEY() random_entry_index()
+#include "key_table.h"
+#include "latency_histogram.h"
+
 // Address is stored in network byte order
 typedef struct _ipv4_route
 {
@@ -52,13 +59,13 @@ SEC("sockops/prepare") int prepare(void* ctx)
     unsigned int prefix_length = 0;
 
     ipv4_route new_route = {0, 0};
-    if (!value || *value >= MAX_ENTRIES) {
+    if (!value || *value >= entry_count) {
         return 0;
     }
 
     index = *value;
 
-    new_route.prefix_length = select_prefix_length(index, MAX_ENTRIES);
+    new_route.prefix_length = select_prefix_length(index, entry_count);
     new_route.address = bpf_get_prandom_u32() & prefix_length_to_network_mask(new_route.prefix_length);
 
     new_route.address = bpf_htonl(new_route.address);
@@ -78,10 +85,10 @@ SEC("sockops/prepare") int prepare(void* ctx)
     return 0;
 }
 
-SEC("sockops/read") int read(void* ctx)
+// Look up an address within the route with the given index, using host_bits for the host part of the address.
+static inline int
+read_route(unsigned int key, unsigned int host_bits)
 {
-    unsigned int key = bpf_get_prandom_u32() % MAX_ENTRIES;
-
     ipv4_route* test_route = bpf_map_lookup_elem(&lpm_routes_map, &key);
     ipv4_route test_address = {32, 0};
 
@@ -90,7 +97,7 @@ SEC("sockops/read") int read(void* ctx)
         return 1;
     }
 
-    test_address.address = prefix_length_to_host_mask(test_route->prefix_length) & bpf_get_prandom_u32();
+    test_address.address = prefix_length_to_host_mask(test_route->prefix_length) & host_bits;
     test_address.address |= bpf_ntohl(test_route->address);
 
     test_address.address = bpf_htonl(test_address.address);
@@ -122,10 +129,36 @@ SEC("sockops/read") int read(void* ctx)
     return 0;
 }
 
-SEC("sockops/update") int update(void* ctx)
+TIMED_PROGRAM(read)
+{
+    return read_route(random_entry_index(), bpf_get_prandom_u32());
+}
+
+// Take the route from the key table and derive the host part of the address from it, so the test doesn't call
+// bpf_get_prandom_u32.
+TIMED_PROGRAM(read_key_table)
+{
+    unsigned int key = next_table_key();
+    return read_route(key, key * 2654435761u);
+}
+
+// Cost of generating the route and host part of the address as read does, which read_key_table replaces with a single
+// key from the key table. The runner reports the difference with table_key_read as the overhead it removes.
+SEC("sockops/random_key_read") int random_key_read(void* ctx)
+{
+    return random_entry_index() ^ bpf_get_prandom_u32();
+}
+
+// Cost of fetching the route from the key table and deriving the host part of the address as read_key_table does.
+SEC("sockops/table_key_read") int table_key_read(void* ctx)
 {
-    unsigned int key = bpf_get_prandom_u32() % MAX_ENTRIES;
+    unsigned int key = next_table_key();
+    return key ^ (key * 2654435761u);
+}
 
+static inline int
+update_route(unsigned int key)
+{
     ipv4_route* test_route = bpf_map_lookup_elem(&lpm_routes_map, &key);
     ipv4_route route_key = {32, 0};
 
@@ -139,10 +172,19 @@ SEC("sockops/update") int update(void* ctx)
     return 0;
 }
 
-SEC("sockops/replace") int replace(void* ctx)
+TIMED_PROGRAM(update)
+{
+    return update_route(random_entry_index());
+}
+
+TIMED_PROGRAM(update_key_table)
 {
-    unsigned int key = bpf_get_prandom_u32() % MAX_ENTRIES;
+    return update_route(next_table_key());
+}
 
+static inline int
+replace_route(unsigned int key)
+{
     ipv4_route* test_route = bpf_map_lookup_elem(&lpm_routes_map, &key);
     ipv4_route route_key = {32, 0};
 
@@ -156,3 +198,13 @@ SEC("sockops/replace") int replace(void* ctx)
 
     return 0;
 }
+
+TIMED_PROGRAM(replace)
+{
+    return replace_route(random_entry_index());
+}
+
+TIMED_PROGRAM(replace_key_table)
+{
+    return replace_route(next_table_key());
+}
@@ -0,0 +1,56 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "bpf.h"
+
+// The map is filled by the runner from runner/tests/lpm_trie_entries.txt, which holds the routes 10.0.0.0/32 to
+// 10.0.0.15/32 with their index as value. Not all kernels support batch operations on LPM tries, so this checks the
+// fallback of the runner to per element updates and deletes.
+#define ROUTE_COUNT 16
+#define ROUTE_BASE_ADDRESS 0x0a000000
+
+// A route that isn't in the file.
+#define EXTRA_ROUTE_ADDRESS 0x0a000100
+
+// Address is stored in network byte order
+typedef struct _ipv4_route
+{
+    unsigned int prefix_length;
+    unsigned int address;
+} ipv4_route;
+
+struct
+{
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __uint(max_entries, 64);
+    __type(key, ipv4_route);
+    __type(value, unsigned int);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+} lpm_map SEC(".maps");
+
+// Return 0 if the map holds exactly the routes of the file, then add a route and remove another one, so that a test
+// that runs next from the same map state only passes if the runner restored the map in between.
+SEC("sockops/check") int check(void* ctx)
+{
+    ipv4_route route = {32, 0};
+    unsigned int value = 0;
+
+#pragma unroll
+    for (unsigned int i = 0; i < ROUTE_COUNT; i++) {
+        route.address = bpf_htonl(ROUTE_BASE_ADDRESS + i);
+        unsigned int* found = bpf_map_lookup_elem(&lpm_map, &route);
+        if (!found || *found != i) {
+            return 1;
+        }
+    }
+
+    route.address = bpf_htonl(EXTRA_ROUTE_ADDRESS);
+    if (bpf_map_lookup_elem(&lpm_map, &route)) {
+        return 1;
+    }
+
+    (void)bpf_map_update_elem(&lpm_map, &route, &value, BPF_ANY);
+    route.address = bpf_htonl(ROUTE_BASE_ADDRESS);
+    (void)bpf_map_delete_elem(&lpm_map, &route);
+    return 0;
+}
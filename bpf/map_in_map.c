@@ -11,6 +11,9 @@
 #define TYPE BPF_MAP_TYPE_HASH_OF_MAPS
 #endif
 
+#define RANDOM_KEY() (bpf_get_prandom_u32() % MAX_ENTRIES)
+#include "key_table.h"
+
 struct
 {
     __uint(type, BPF_MAP_TYPE_HASH);
@@ -50,10 +53,10 @@ SEC("sockops/prepare") int prepare(void* ctx)
     return 0;
 }
 
-SEC("sockops/read") int read(void* ctx)
+static inline int
+read_inner_map(int key)
 {
     int outer_key = 0;
-    int key = bpf_get_prandom_u32() % MAX_ENTRIES;
     void* map = bpf_map_lookup_elem(&outer_map, &outer_key);
     if (!map) {
         return 2;
@@ -66,13 +69,33 @@ SEC("sockops/read") int read(void* ctx)
     return 1;
 }
 
-SEC("sockops/update") int update(void* ctx)
+SEC("sockops/read") int read(void* ctx)
+{
+    return read_inner_map(bpf_get_prandom_u32() % MAX_ENTRIES);
+}
+
+SEC("sockops/read_key_table") int read_key_table(void* ctx)
+{
+    return read_inner_map(next_table_key());
+}
+
+static inline int
+update_inner_map(int key)
 {
     int outer_key = 0;
-    int key = bpf_get_prandom_u32() % MAX_ENTRIES;
     void* map = bpf_map_lookup_elem(&outer_map, &outer_key);
     if (!map) {
         return 1;
     }
     return bpf_map_update_elem(map, &key, &key, BPF_ANY);
 }
+
+SEC("sockops/update") int update(void* ctx)
+{
+    return update_inner_map(bpf_get_prandom_u32() % MAX_ENTRIES);
+}
+
+SEC("sockops/update_key_table") int update_key_table(void* ctx)
+{
+    return update_inner_map(next_table_key());
+}
@@ -0,0 +1,31 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "bpf.h"
+
+#if !defined(MAX_ENTRIES)
+#define MAX_ENTRIES 1024
+#endif
+
+#include "entry_count.h"
+
+// Array of counters that userspace can read and write through a mapping of the map, as well as with syscalls.
+struct
+{
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(map_flags, BPF_F_MMAPABLE);
+    __uint(max_entries, MAX_ENTRIES);
+    __type(key, unsigned int);
+    __type(value, unsigned long long);
+} map SEC(".maps");
+
+// Increment a random counter, as a program updating statistics would.
+SEC("sockops/update") int update(void* ctx)
+{
+    unsigned int key = random_entry_index();
+    unsigned long long* value = bpf_map_lookup_elem(&map, &key);
+    if (value) {
+        __sync_fetch_and_add(value, 1);
+    }
+    return 0;
+}
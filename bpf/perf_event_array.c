@@ -0,0 +1,39 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "bpf.h"
+
+#if !defined(RECORD_SIZE)
+#define RECORD_SIZE 128
+#endif
+
+// Each CPU has its own perf buffer, sized by the consumer when it opens it.
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERF_EVENT_ARRAY);
+    __uint(key_size, sizeof(int));
+    __uint(value_size, sizeof(int));
+} perf_map SEC(".maps");
+
+// Per CPU record buffer, so that concurrent producers don't overwrite each other's timestamps.
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, int);
+    __uint(max_entries, 1);
+    __uint(value_size, RECORD_SIZE);
+} timestamped_buf_map SEC(".maps");
+
+// Produce a record that starts with the time it was produced at into the perf buffer of the current CPU. As with the
+// ring buffer, a full perf buffer isn't a failure: the runner counts the records that weren't consumed as dropped.
+SEC("sockops/perf_event_output") int perf_event_output(void* ctx)
+{
+    int key = 0;
+    unsigned long long* msg = bpf_map_lookup_elem(&timestamped_buf_map, &key);
+    if (!msg) {
+        return 1;
+    }
+    *msg = bpf_ktime_get_ns();
+    (void)bpf_perf_event_output(ctx, &perf_map, BPF_F_CURRENT_CPU, msg, RECORD_SIZE);
+    return 0;
+}
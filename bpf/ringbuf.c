@@ -38,3 +38,74 @@ SEC("sockops/bpf_ringbuf_output") int output(void* ctx)
         return 0;
     }
 }
+
+// Per CPU record buffer, so that concurrent producers don't overwrite each other's timestamps.
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, int);
+    __uint(max_entries, 1);
+    __uint(value_size, RECORD_SIZE);
+} timestamped_buf_map SEC(".maps");
+
+// Produce a record that starts with the time it was produced at, so that a consumer can measure the latency, either
+// by copying it with bpf_ringbuf_output or by writing it in place between bpf_ringbuf_reserve and bpf_ringbuf_submit.
+// The flags control the wakeup of the consumer. A full ring buffer isn't a failure: the runner counts the records that
+// weren't consumed as dropped.
+static inline int
+output_record(unsigned long long flags)
+{
+    int key = 0;
+    unsigned long long* msg = bpf_map_lookup_elem(&timestamped_buf_map, &key);
+    if (!msg) {
+        return 1;
+    }
+    *msg = bpf_ktime_get_ns();
+    (void)bpf_ringbuf_output(&rb_map, msg, RECORD_SIZE, flags);
+    return 0;
+}
+
+SEC("sockops/output_timestamped") int output_timestamped(void* ctx)
+{
+    return output_record(0);
+}
+
+// The wakeup flags and bpf_ringbuf_reserve are only used on Linux.
+#if defined(PLATFORM_LINUX)
+static inline int
+reserve_and_submit_record(unsigned long long flags)
+{
+    unsigned long long* record = bpf_ringbuf_reserve(&rb_map, RECORD_SIZE, 0);
+    if (!record) {
+        return 0;
+    }
+    *record = bpf_ktime_get_ns();
+    bpf_ringbuf_submit(record, flags);
+    return 0;
+}
+
+SEC("sockops/output_timestamped_no_wakeup") int output_timestamped_no_wakeup(void* ctx)
+{
+    return output_record(BPF_RB_NO_WAKEUP);
+}
+
+SEC("sockops/output_timestamped_force_wakeup") int output_timestamped_force_wakeup(void* ctx)
+{
+    return output_record(BPF_RB_FORCE_WAKEUP);
+}
+
+SEC("sockops/reserve_submit") int reserve_submit(void* ctx)
+{
+    return reserve_and_submit_record(0);
+}
+
+SEC("sockops/reserve_submit_no_wakeup") int reserve_submit_no_wakeup(void* ctx)
+{
+    return reserve_and_submit_record(BPF_RB_NO_WAKEUP);
+}
+
+SEC("sockops/reserve_submit_force_wakeup") int reserve_submit_force_wakeup(void* ctx)
+{
+    return reserve_and_submit_record(BPF_RB_FORCE_WAKEUP);
+}
+#endif
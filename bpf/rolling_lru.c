@@ -8,6 +8,10 @@
 #endif
 #define KEY_RANGE (MAX_ENTRIES / 10) // 10% of MAX_ENTRIES
 
+#define RANDOM_KEY() (bpf_get_prandom_u32() % KEY_RANGE)
+#include "key_table.h"
+#include "latency_histogram.h"
+
 // This test measures the performance of the LRU hash with a rolling key set.
 // Searches are performed in the LRU map using keys in the range [lru_key_base, lru_key_base + lru_key_range).
 // If the key is found in the map, it is updated with 0.
@@ -57,9 +61,9 @@ SEC("sockops/prepare") int prepare(void* ctx)
 // If found in the map, update the value to 0.
 // If not found in the map, add the key to the map with value 0.
 // Increment lru_key_base by 1 on every 10th iteration on CPU 0.
-SEC("sockops/read_or_update") int read_or_update(void* ctx)
+static inline int
+read_or_update_key(int key)
 {
-    int key = bpf_get_prandom_u32() % KEY_RANGE;
     int zero = 0;
     unsigned int* key_base = bpf_map_lookup_elem(&lru_key_base, &zero);
     if (!key_base) {
@@ -82,4 +86,15 @@ SEC("sockops/read_or_update") int read_or_update(void* ctx)
         bpf_map_update_elem(&rolling_lru_map, &key, &zero, BPF_ANY);
     }
     return 0;
-}
\ No newline at end of file
+}
+
+TIMED_PROGRAM(read_or_update)
+{
+    return read_or_update_key(bpf_get_prandom_u32() % KEY_RANGE);
+}
+
+// Variant of read_or_update that takes the key offset from the key table, which should range over KEY_RANGE keys.
+TIMED_PROGRAM(read_or_update_key_table)
+{
+    return read_or_update_key(next_table_key());
+}
@@ -0,0 +1,68 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "bpf.h"
+
+#if !defined(RB_SIZE)
+#define RB_SIZE (256 * 1024)
+#endif
+
+#if !defined(RECORD_SIZE)
+#define RECORD_SIZE 128
+#endif
+
+// Ring buffer that the runner produces records into from userspace.
+struct
+{
+    __uint(type, BPF_MAP_TYPE_USER_RINGBUF);
+    __uint(max_entries, RB_SIZE);
+} user_rb_map SEC(".maps");
+
+// Per CPU buffer that each record is copied into, as a program applying the record would.
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, int);
+    __uint(max_entries, 1);
+    __uint(value_size, RECORD_SIZE);
+} record_buf_map SEC(".maps");
+
+// Per CPU number of records drained, which the runner reads to compute the drain rate and cost per record.
+struct
+{
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, int);
+    __type(value, unsigned long long);
+    __uint(max_entries, 1);
+} drained_count_map SEC(".maps");
+
+static long
+copy_record(struct bpf_dynptr* dynptr, void* context)
+{
+    int key = 0;
+    void* record = bpf_map_lookup_elem(&record_buf_map, &key);
+    if (!record) {
+        return 1;
+    }
+    // Stop draining on a record of the wrong size.
+    if (bpf_dynptr_read(record, RECORD_SIZE, dynptr, 0, 0) < 0) {
+        return 1;
+    }
+    return 0;
+}
+
+// Drain the records available in the user ring buffer, up to the limit of bpf_user_ringbuf_drain.
+SEC("sockops/user_ringbuf_drain") int drain(void* ctx)
+{
+    int key = 0;
+    unsigned long long* drained_count = bpf_map_lookup_elem(&drained_count_map, &key);
+    if (!drained_count) {
+        return 1;
+    }
+    long drained = bpf_user_ringbuf_drain(&user_rb_map, copy_record, NULL, 0);
+    if (drained < 0) {
+        return 1;
+    }
+    *drained_count += drained;
+    return 0;
+}
@@ -0,0 +1,124 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "background_workload.h"
+
+#include "map_state.h"
+
+#include <bpf/bpf.h>
+#include <stdexcept>
+
+background_workload::background_workload(
+    const bpf_object* obj, const std::vector<background_workload_parameters>& workloads)
+{
+    for (const auto& parameters : workloads) {
+        auto map = bpf_object__find_map_by_name(obj, parameters.map_name.c_str());
+        if (!map) {
+            throw std::runtime_error("Failed to find map " + parameters.map_name);
+        }
+        if (parameters.operation != "update" && parameters.operation != "delete" &&
+            parameters.operation != "replace" && parameters.operation != "update_batch") {
+            throw std::runtime_error("Unknown background workload operation " + parameters.operation);
+        }
+        if (parameters.threads == 0 || parameters.batch_size == 0 || parameters.rate < 0) {
+            throw std::runtime_error(
+                "Fields background_workload.threads and batch_size must be greater than zero and rate must not be "
+                "negative");
+        }
+
+        workload workload = {parameters, bpf_map__fd(map), bpf_map__key_size(map), map_value_buffer_size(map)};
+        if (workload.parameters.key_count == 0) {
+            workload.parameters.key_count = bpf_map__max_entries(map);
+        }
+        this->workloads.push_back(workload);
+    }
+}
+
+background_workload::~background_workload()
+{
+    if (!threads.empty()) {
+        stop();
+    }
+}
+
+void
+background_workload::start()
+{
+    operation_count = 0;
+    start_time = std::chrono::steady_clock::now();
+    for (const auto& workload : workloads) {
+        for (uint32_t i = 0; i < workload.parameters.threads; i++) {
+            threads.emplace_back([this, &workload, i](std::stop_token stop_token) { run(workload, i, stop_token); });
+        }
+    }
+}
+
+double
+background_workload::stop()
+{
+    for (auto& thread : threads) {
+        thread.request_stop();
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    return elapsed > 0 ? operation_count / elapsed : 0;
+}
+
+void
+background_workload::run(const workload& workload, uint32_t thread_index, std::stop_token stop_token)
+{
+    const auto& parameters = workload.parameters;
+    uint32_t batch_size = parameters.operation == "update_batch" ? parameters.batch_size : 1;
+    uint32_t operations_per_step = parameters.operation == "replace" ? 2 : batch_size;
+
+    // Each thread starts at its own share of the keys, so that threads don't modify the same keys in lockstep.
+    uint64_t first_key = static_cast<uint64_t>(parameters.key_count) * thread_index / parameters.threads;
+    uint32_t key = static_cast<uint32_t>(first_key);
+
+    map_entries entries;
+    entries.key_size = workload.key_size;
+    entries.value_size = workload.value_size;
+    entries.keys.resize(batch_size * entries.key_size);
+    entries.values.resize(batch_size * entries.value_size);
+
+    // Pace the thread so that it completes its share of the rate, catching up after it falls behind.
+    double thread_rate = parameters.rate / parameters.threads;
+    auto thread_start_time = std::chrono::steady_clock::now();
+    uint64_t completed = 0;
+
+    while (!stop_token.stop_requested()) {
+        if (thread_rate > 0) {
+            auto offset = std::chrono::duration<double>(completed / thread_rate);
+            std::this_thread::sleep_until(
+                thread_start_time + std::chrono::duration_cast<std::chrono::steady_clock::duration>(offset));
+        }
+
+        for (uint32_t i = 0; i < batch_size; i++) {
+            store_integer(entries.keys.data() + i * entries.key_size, entries.key_size, key);
+            store_integer(entries.values.data() + i * entries.value_size, entries.value_size, key);
+            key = key + 1 < parameters.key_count ? key + 1 : 0;
+        }
+
+        // Failures such as deleting a key that is already gone are expected and ignored.
+        if (parameters.operation == "update") {
+            (void)bpf_map_update_elem(workload.map_fd, entries.keys.data(), entries.values.data(), BPF_ANY);
+        } else if (parameters.operation == "delete") {
+            (void)bpf_map_delete_elem(workload.map_fd, entries.keys.data());
+        } else if (parameters.operation == "replace") {
+            (void)bpf_map_delete_elem(workload.map_fd, entries.keys.data());
+            (void)bpf_map_update_elem(workload.map_fd, entries.keys.data(), entries.values.data(), BPF_ANY);
+        } else {
+            try {
+                update_map_entries(workload.map_fd, parameters.map_name, entries);
+            } catch (const std::runtime_error&) {
+            }
+        }
+
+        completed += operations_per_step;
+        operation_count += operations_per_step;
+    }
+}
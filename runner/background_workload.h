@@ -0,0 +1,68 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <atomic>
+#include <bpf/libbpf.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Userspace modifications applied to a map of a test while its programs run, as a control plane would.
+struct background_workload_parameters
+{
+    // Name of the map to modify.
+    std::string map_name;
+    // One of:
+    // - update: update the keys in turn.
+    // - delete: delete the keys in turn.
+    // - replace: delete and then update each key in turn, which keeps the map populated.
+    // - update_batch: update batch_size keys at a time with bpf_map_update_batch.
+    std::string operation = "update";
+    // Number of keys cycled through, defaulting to the max_entries of the map. Keys are the little-endian integers
+    // 0, 1, 2, ..., as stored by the sequential generator of the map state preparation, and values hold their key.
+    uint32_t key_count = 0;
+    // Number of keys updated by each batch operation.
+    uint32_t batch_size = 64;
+    // Target number of element operations per second across all threads, or 0 to run as fast as possible.
+    double rate = 0;
+    // Number of userspace threads applying the workload, each cycling through its own share of the keys.
+    uint32_t threads = 1;
+};
+
+// Threads applying background workloads to the maps of a BPF object.
+class background_workload
+{
+  public:
+    background_workload(const bpf_object* obj, const std::vector<background_workload_parameters>& workloads);
+    ~background_workload();
+
+    // Start the threads, which run until stop is called.
+    void
+    start();
+
+    // Stop the threads and return the number of element operations per second they completed while running.
+    double
+    stop();
+
+  private:
+    struct workload
+    {
+        background_workload_parameters parameters;
+        int map_fd;
+        size_t key_size;
+        size_t value_size;
+    };
+
+    void
+    run(const workload& workload, uint32_t thread_index, std::stop_token stop_token);
+
+    std::vector<workload> workloads;
+    std::vector<std::jthread> threads;
+    std::atomic<uint64_t> operation_count = 0;
+    std::chrono::steady_clock::time_point start_time;
+};
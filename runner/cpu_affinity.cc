@@ -0,0 +1,48 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "cpu_affinity.h"
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#else
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+bool
+pin_current_thread_to_cpu(size_t cpu)
+{
+#if defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) == 0;
+#else
+    if (cpu >= sizeof(DWORD_PTR) * 8) {
+        return false;
+    }
+    return SetThreadAffinityMask(GetCurrentThread(), static_cast<DWORD_PTR>(1) << cpu) != 0;
+#endif
+}
+
+bool
+cpu_is_available(size_t cpu)
+{
+#if defined(__linux__)
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    if (cpu >= CPU_SETSIZE || sched_getaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+        return false;
+    }
+    return CPU_ISSET(cpu, &cpu_set);
+#else
+    DWORD_PTR process_mask;
+    DWORD_PTR system_mask;
+    if (cpu >= sizeof(DWORD_PTR) * 8 || !GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask)) {
+        return false;
+    }
+    return (process_mask & (static_cast<DWORD_PTR>(1) << cpu)) != 0;
+#endif
+}
@@ -0,0 +1,14 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstddef>
+
+// Pin the calling thread to the given CPU, returning false if the CPU can't be pinned to.
+bool
+pin_current_thread_to_cpu(size_t cpu);
+
+// Return true if the process may run on the given CPU, which excludes CPUs that are offline or outside its cpuset.
+bool
+cpu_is_available(size_t cpu);
@@ -0,0 +1,85 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "execution_backend.h"
+
+#include "ubpf_backend.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+// Loads the objects into the kernel with libbpf and runs the programs with bpf_prog_test_run_opts.
+class kernel_backend : public execution_backend
+{
+  public:
+    std::string
+    name() const override
+    {
+        return "kernel";
+    }
+
+    bool
+    runs_in_kernel() const override
+    {
+        return true;
+    }
+
+    void
+    load(bpf_object* obj, const std::string& elf_file) override
+    {
+        if (bpf_object__load(obj) < 0) {
+            throw std::runtime_error(
+                "Failed to load BPF object " + elf_file + ": " + strerror(errno) + "/" + std::to_string(errno));
+        }
+    }
+
+    void
+    unload(const bpf_object* obj) override
+    {
+        // Closing the object releases its programs and maps.
+        (void)obj;
+    }
+
+    int
+    program_handle(const bpf_program* program) override
+    {
+        return bpf_program__fd(program);
+    }
+
+    int
+    test_run(int program, bpf_test_run_opts* opts) override
+    {
+        return bpf_prog_test_run_opts(program, opts);
+    }
+
+    void
+    update_map_entries(const bpf_map* map, map_entries& entries) override
+    {
+        ::update_map_entries(bpf_map__fd(map), bpf_map__name(map), entries);
+    }
+
+    map_state_snapshot
+    snapshot_map_state(const bpf_object* obj) override
+    {
+        return ::snapshot_map_state(obj);
+    }
+
+    void
+    restore_map_state(const bpf_object* obj, map_state_snapshot& snapshot) override
+    {
+        ::restore_map_state(obj, snapshot);
+    }
+};
+
+std::unique_ptr<execution_backend>
+create_execution_backend(const std::string& name)
+{
+    if (name == "kernel") {
+        return std::make_unique<kernel_backend>();
+    } else if (name == "ubpf" || name == "ubpf-jit") {
+        return create_ubpf_backend(name == "ubpf-jit");
+    } else {
+        throw std::runtime_error("Unknown backend " + name);
+    }
+}
@@ -0,0 +1,67 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "map_state.h"
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+// Thrown when a test uses a runner feature, helper or map type that the backend doesn't support, or needs more CPUs
+// than the host has. The runner skips the test and continues with the next one.
+class unsupported_by_backend_error : public std::runtime_error
+{
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+// Loads the BPF objects opened by libbpf, runs their programs and accesses their maps. The kernel backend loads the
+// objects into the kernel and runs the programs with bpf_prog_test_run_opts. Userspace backends run the programs in a
+// BPF VM with emulated helpers and maps, which doesn't require privileges.
+class execution_backend
+{
+  public:
+    virtual ~execution_backend() = default;
+
+    // Name of the backend, as passed to --backend.
+    virtual std::string
+    name() const = 0;
+
+    // True if the programs and maps are kernel objects, which the runner features that access them directly require.
+    virtual bool
+    runs_in_kernel() const = 0;
+
+    // Load an object that libbpf opened from elf_file, after its program types and map overrides were set.
+    virtual void
+    load(bpf_object* obj, const std::string& elf_file) = 0;
+
+    // Release what the backend holds for a loaded object, before the runner closes it.
+    virtual void
+    unload(const bpf_object* obj) = 0;
+
+    // Return the handle test_run runs a program of a loaded object with.
+    virtual int
+    program_handle(const bpf_program* program) = 0;
+
+    // Run a program as bpf_prog_test_run_opts does, returning 0 or a negative error.
+    virtual int
+    test_run(int program, bpf_test_run_opts* opts) = 0;
+
+    // Map access of the map state preparation and isolation, as in map_state.h.
+    virtual void
+    update_map_entries(const bpf_map* map, map_entries& entries) = 0;
+
+    virtual map_state_snapshot
+    snapshot_map_state(const bpf_object* obj) = 0;
+
+    virtual void
+    restore_map_state(const bpf_object* obj, map_state_snapshot& snapshot) = 0;
+};
+
+// Create the backend with the given name: kernel, ubpf (the uBPF interpreter) or ubpf-jit (the uBPF JIT compiler).
+std::unique_ptr<execution_backend>
+create_execution_backend(const std::string& name);
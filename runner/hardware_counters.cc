@@ -0,0 +1,104 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "hardware_counters.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+// Open a counter of the calling thread on the given CPU, disabled until started. Returns -1 if the event isn't
+// supported, which is the case of hardware events in most virtual machines.
+static int
+open_counter(uint32_t type, uint64_t config, int cpu)
+{
+    perf_event_attr attr = {};
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, cpu, -1, 0));
+}
+
+static uint64_t
+cache_event(uint64_t cache, uint64_t operation, uint64_t result)
+{
+    return cache | (operation << 8) | (result << 16);
+}
+#endif
+
+hardware_counters::hardware_counters(int cpu)
+{
+    fds.fill(-1);
+#if defined(__linux__)
+    fds[hardware_counter_cycles] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, cpu);
+    fds[hardware_counter_instructions] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, cpu);
+    fds[hardware_counter_l1d_misses] = open_counter(
+        PERF_TYPE_HW_CACHE,
+        cache_event(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS),
+        cpu);
+    fds[hardware_counter_llc_misses] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, cpu);
+    fds[hardware_counter_dtlb_misses] = open_counter(
+        PERF_TYPE_HW_CACHE,
+        cache_event(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ, PERF_COUNT_HW_CACHE_RESULT_MISS),
+        cpu);
+    fds[hardware_counter_branch_misses] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, cpu);
+    fds[hardware_counter_task_clock] = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK, cpu);
+    fds[hardware_counter_context_switches] = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, cpu);
+    fds[hardware_counter_page_faults] = open_counter(PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS, cpu);
+#else
+    (void)cpu;
+#endif
+}
+
+hardware_counters::~hardware_counters()
+{
+#if defined(__linux__)
+    for (int fd : fds) {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+#endif
+}
+
+void
+hardware_counters::start()
+{
+#if defined(__linux__)
+    for (int fd : fds) {
+        if (fd >= 0) {
+            (void)ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            (void)ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+hardware_counter_values
+hardware_counters::stop()
+{
+    hardware_counter_values values;
+#if defined(__linux__)
+    for (int fd : fds) {
+        if (fd >= 0) {
+            (void)ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        }
+    }
+    for (size_t event = 0; event < fds.size(); event++) {
+        // Value, time enabled and time running.
+        uint64_t counts[3];
+        if (fds[event] < 0 || read(fds[event], counts, sizeof(counts)) != sizeof(counts) || counts[2] == 0) {
+            continue;
+        }
+        values[event] = static_cast<double>(counts[0]) * counts[1] / counts[2];
+    }
+#endif
+    return values;
+}
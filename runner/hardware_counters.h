@@ -0,0 +1,53 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+// Events counted around each program run. The hardware events are unavailable in most virtual machines, where the
+// software events still give the CPU time per invocation and explain some of the noise.
+enum hardware_counter_event
+{
+    hardware_counter_cycles,
+    hardware_counter_instructions,
+    hardware_counter_l1d_misses,
+    hardware_counter_llc_misses,
+    hardware_counter_dtlb_misses,
+    hardware_counter_branch_misses,
+    // CPU time of the thread in nanoseconds.
+    hardware_counter_task_clock,
+    hardware_counter_context_switches,
+    hardware_counter_page_faults,
+    hardware_counter_event_count
+};
+
+// Counts of each event, or nullopt for events that couldn't be counted. Counts are scaled up when the kernel had to
+// multiplex the counters.
+using hardware_counter_values = std::array<std::optional<double>, hardware_counter_event_count>;
+
+// perf_event_open counters of the calling thread while it runs on the given CPU (Linux only).
+class hardware_counters
+{
+  public:
+    explicit hardware_counters(int cpu);
+    ~hardware_counters();
+    hardware_counters(const hardware_counters&) = delete;
+    hardware_counters&
+    operator=(const hardware_counters&) = delete;
+
+    // Reset and start counting.
+    void
+    start();
+
+    // Stop counting and return the counts since start.
+    hardware_counter_values
+    stop();
+
+  private:
+    std::array<int, hardware_counter_event_count> fds;
+};
@@ -0,0 +1,168 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "key_distribution.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+
+// Sampler for the Zipf distribution over [1, n] with the given exponent, using the rejection-inversion method of
+// Hormann and Derflinger, which needs constant memory and time per sample for any number of elements.
+class zipf_sampler
+{
+  public:
+    zipf_sampler(uint32_t n, double exponent) : n(n), exponent(exponent)
+    {
+        h_integral_x1 = h_integral(1.5) - 1;
+        h_integral_n = h_integral(n + 0.5);
+        s = 2 - h_integral_inverse(h_integral(2.5) - h(2));
+    }
+
+    uint32_t
+    operator()(std::mt19937_64& random)
+    {
+        std::uniform_real_distribution<double> uniform(0, 1);
+        for (;;) {
+            double u = h_integral_n + uniform(random) * (h_integral_x1 - h_integral_n);
+            double x = h_integral_inverse(u);
+            double k = std::clamp(std::floor(x + 0.5), 1.0, static_cast<double>(n));
+            if (k - x <= s || u >= h_integral(k + 0.5) - h(k)) {
+                return static_cast<uint32_t>(k);
+            }
+        }
+    }
+
+  private:
+    double
+    h(double x) const
+    {
+        return std::exp(-exponent * std::log(x));
+    }
+
+    double
+    h_integral(double x) const
+    {
+        double log_x = std::log(x);
+        return helper2((1 - exponent) * log_x) * log_x;
+    }
+
+    double
+    h_integral_inverse(double x) const
+    {
+        double t = std::max(x * (1 - exponent), -1.0);
+        return std::exp(helper1(t) * x);
+    }
+
+    // log(1 + x) / x, accurate near 0.
+    static double
+    helper1(double x)
+    {
+        return std::abs(x) > 1e-8 ? std::log1p(x) / x : 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+    }
+
+    // (exp(x) - 1) / x, accurate near 0.
+    static double
+    helper2(double x)
+    {
+        return std::abs(x) > 1e-8 ? std::expm1(x) / x : 1 + x * 0.5 * (1 + x / 3 * (1 + 0.25 * x));
+    }
+
+    uint32_t n;
+    double exponent;
+    double h_integral_x1;
+    double h_integral_n;
+    double s;
+};
+
+std::vector<uint32_t>
+generate_keys(const key_distribution_parameters& parameters, size_t count, size_t cpu, size_t cpu_count)
+{
+    uint32_t key_count = parameters.key_count;
+    if (key_count == 0) {
+        throw std::runtime_error("Field key_distribution.key_count must be greater than zero");
+    }
+    if (parameters.miss_ratio < 0 || parameters.miss_ratio > 1) {
+        throw std::runtime_error("Field key_distribution.miss_ratio must be between 0 and 1");
+    }
+
+    std::mt19937_64 random(parameters.seed + cpu);
+    std::uniform_int_distribution<uint32_t> any_key(0, key_count - 1);
+    std::vector<uint32_t> keys(count);
+
+    if (parameters.type == "uniform") {
+        for (auto& key : keys) {
+            key = any_key(random);
+        }
+    } else if (parameters.type == "zipf") {
+        if (parameters.theta < 0) {
+            throw std::runtime_error("Field key_distribution.theta must not be negative");
+        }
+        zipf_sampler zipf(key_count, parameters.theta);
+        for (auto& key : keys) {
+            key = zipf(random) - 1;
+        }
+    } else if (parameters.type == "hot_set") {
+        if (parameters.hot_set <= 0 || parameters.hot_set > 1 || parameters.hot_access < 0 ||
+            parameters.hot_access > 1) {
+            throw std::runtime_error("Fields key_distribution.hot_set and hot_access must be between 0 and 1");
+        }
+        uint32_t hot_count = std::max<uint32_t>(1, static_cast<uint32_t>(std::ceil(key_count * parameters.hot_set)));
+        std::uniform_int_distribution<uint32_t> hot_key(0, hot_count - 1);
+        std::uniform_int_distribution<uint32_t> cold_key(std::min(hot_count, key_count - 1), key_count - 1);
+        std::bernoulli_distribution is_hot(parameters.hot_access);
+        for (auto& key : keys) {
+            key = is_hot(random) || hot_count == key_count ? hot_key(random) : cold_key(random);
+        }
+    } else if (parameters.type == "sequential") {
+        // Spread the starting points so that CPUs don't access the same keys in lockstep.
+        uint64_t position = static_cast<uint64_t>(key_count) * cpu / std::max<size_t>(cpu_count, 1);
+        for (auto& key : keys) {
+            key = static_cast<uint32_t>(position % key_count);
+            position += parameters.stride;
+        }
+    } else {
+        throw std::runtime_error("Unknown key distribution " + parameters.type);
+    }
+
+    // Replace a fraction of the accesses with keys that aren't in the map.
+    if (parameters.miss_ratio > 0) {
+        std::bernoulli_distribution is_miss(parameters.miss_ratio);
+        for (auto& key : keys) {
+            if (is_miss(random)) {
+                key = key_count + any_key(random);
+            }
+        }
+    }
+    return keys;
+}
+
+std::vector<uint32_t>
+generate_operations(const std::vector<double>& weights, size_t count, size_t cpu, uint64_t seed)
+{
+    double total_weight = 0;
+    for (auto weight : weights) {
+        if (weight < 0) {
+            throw std::runtime_error("Weights of operation_mix must not be negative");
+        }
+        total_weight += weight;
+    }
+    if (total_weight <= 0) {
+        throw std::runtime_error("Weights of operation_mix must add up to more than zero");
+    }
+
+    // Give each operation its share of the stream, rounded so that the shares add up to count.
+    std::vector<uint32_t> operations;
+    operations.reserve(count);
+    double cumulative_weight = 0;
+    for (size_t i = 0; i < weights.size(); i++) {
+        cumulative_weight += weights[i];
+        size_t end = static_cast<size_t>(std::llround(cumulative_weight / total_weight * count));
+        operations.resize(std::max(operations.size(), std::min(end, count)), static_cast<uint32_t>(i));
+    }
+
+    std::mt19937_64 random(seed + cpu);
+    std::shuffle(operations.begin(), operations.end(), random);
+    return operations;
+}
@@ -0,0 +1,38 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Distribution of the keys accessed by a test, over the keys [0, key_count) that are present in the map.
+struct key_distribution_parameters
+{
+    // One of:
+    // - uniform: every key is equally likely.
+    // - zipf: the key with rank k (key k - 1) is accessed with a probability proportional to 1 / k^theta.
+    // - hot_set: hot_access of the accesses go to the first hot_set fraction of the keys, the rest to the others.
+    // - sequential: keys 0, stride, 2 * stride, ... modulo key_count, starting at a different offset on each CPU.
+    std::string type = "uniform";
+    uint32_t key_count = 0;
+    double theta = 0.99;
+    double hot_set = 0.2;
+    double hot_access = 0.8;
+    uint32_t stride = 1;
+    // Fraction of the accesses replaced with keys beyond key_count, which aren't present in the map.
+    double miss_ratio = 0;
+    uint64_t seed = 0;
+};
+
+// Generate the stream of count keys used by the given CPU. Each CPU gets an independent stream.
+std::vector<uint32_t>
+generate_keys(const key_distribution_parameters& parameters, size_t count, size_t cpu, size_t cpu_count);
+
+// Generate the stream of count operations used by the given CPU, where operation i makes up weights[i] divided by the
+// sum of the weights of the stream. The operations are shuffled so that they are interleaved, in a different order on
+// each CPU.
+std::vector<uint32_t>
+generate_operations(const std::vector<double>& weights, size_t count, size_t cpu, uint64_t seed);
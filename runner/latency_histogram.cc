@@ -0,0 +1,66 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "latency_histogram.h"
+
+#include <algorithm>
+#include <bpf/bpf.h>
+#include <cmath>
+#include <numeric>
+#include <stdexcept>
+
+std::vector<uint64_t>
+read_latency_histogram(const bpf_object* obj, const std::string& map_name)
+{
+    auto map = bpf_object__find_map_by_name(obj, map_name.c_str());
+    if (!map) {
+        throw std::runtime_error("Failed to find map " + map_name);
+    }
+    if (bpf_map__type(map) != BPF_MAP_TYPE_PERCPU_ARRAY || bpf_map__max_entries(map) != latency_histogram_bucket_count ||
+        bpf_map__value_size(map) != sizeof(uint64_t)) {
+        throw std::runtime_error("Map " + map_name + " is not a latency histogram");
+    }
+
+    int map_fd = bpf_map__fd(map);
+    std::vector<uint64_t> counts(latency_histogram_bucket_count);
+    std::vector<uint64_t> cpu_counts(libbpf_num_possible_cpus());
+    for (uint32_t bucket = 0; bucket < latency_histogram_bucket_count; bucket++) {
+        if (bpf_map_lookup_elem(map_fd, &bucket, cpu_counts.data()) < 0) {
+            throw std::runtime_error("Failed to read map " + map_name);
+        }
+        counts[bucket] = std::accumulate(cpu_counts.begin(), cpu_counts.end(), uint64_t{0});
+    }
+    return counts;
+}
+
+double
+latency_histogram_percentile(const std::vector<uint64_t>& counts, double percentile)
+{
+    uint64_t total = std::accumulate(counts.begin(), counts.end(), uint64_t{0});
+    if (total == 0) {
+        return 0;
+    }
+
+    // Find the bucket holding the sample of the requested rank.
+    uint64_t rank = static_cast<uint64_t>(std::ceil(percentile / 100.0 * total));
+    rank = std::max<uint64_t>(rank, 1);
+    uint32_t bucket = 0;
+    uint64_t seen = 0;
+    for (; bucket + 1 < counts.size(); bucket++) {
+        seen += counts[bucket];
+        if (seen >= rank) {
+            break;
+        }
+    }
+
+    // Linear buckets hold a single value, and the buckets of each power of 2 split it evenly.
+    const uint32_t linear_buckets = 1 << latency_histogram_linear_bits;
+    if (bucket < linear_buckets) {
+        return bucket;
+    }
+    uint32_t exponent = bucket / linear_buckets + latency_histogram_linear_bits - 1;
+    uint32_t shift = exponent - latency_histogram_linear_bits;
+    double low = static_cast<double>(static_cast<uint64_t>(linear_buckets + bucket % linear_buckets) << shift);
+    double width = static_cast<double>(uint64_t{1} << shift);
+    return low + width / 2;
+}
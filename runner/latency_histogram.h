@@ -0,0 +1,26 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <bpf/libbpf.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Layout of the log-linear latency histograms that programs built with LATENCY_HISTOGRAM record into. Latencies below
+// 2^latency_histogram_linear_bits ns have a bucket each, and every power of 2 above that is split into
+// 2^latency_histogram_linear_bits buckets. Must match bpf/latency_histogram.h.
+const uint32_t latency_histogram_linear_bits = 4;
+const uint32_t latency_histogram_max_exponent = 40;
+const uint32_t latency_histogram_bucket_count = (latency_histogram_max_exponent - latency_histogram_linear_bits + 1)
+                                                << latency_histogram_linear_bits;
+
+// Read the per CPU latency histogram map of a BPF object, returning the count of each bucket summed across CPUs.
+std::vector<uint64_t>
+read_latency_histogram(const bpf_object* obj, const std::string& map_name);
+
+// Return the requested percentile (0-100) of the latencies counted in a histogram, as the midpoint of the bucket it
+// falls in, or 0 if the histogram is empty.
+double
+latency_histogram_percentile(const std::vector<uint64_t>& counts, double percentile);
@@ -0,0 +1,110 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "load_statistics.h"
+
+#include <bpf/bpf.h>
+#include <regex>
+#include <stdexcept>
+
+// Size of the log of each program. Only the statistics are logged, which take a few lines.
+const size_t verifier_log_size = 4096;
+
+// Log level that makes the verifier only log its statistics (BPF_LOG_STATS).
+const uint32_t verifier_log_level_statistics = 4;
+
+verifier_logs
+request_verifier_statistics(bpf_object* obj)
+{
+    verifier_logs logs;
+#if defined(__linux__) && defined(HAS_BPF_PROGRAM_LOG_BUF)
+    bpf_program* program;
+    size_t program_count = 0;
+    bpf_object__for_each_program(program, obj)
+    {
+        program_count++;
+    }
+    logs.assign(program_count, std::vector<char>(verifier_log_size));
+
+    size_t index = 0;
+    bpf_object__for_each_program(program, obj)
+    {
+        auto& log = logs[index++];
+        if (bpf_program__set_log_buf(program, log.data(), log.size()) < 0 ||
+            bpf_program__set_log_level(program, verifier_log_level_statistics) < 0) {
+            throw std::runtime_error(
+                "Failed to request the verifier statistics of program " + std::string(bpf_program__name(program)));
+        }
+    }
+#else
+    (void)obj;
+#endif
+    return logs;
+}
+
+std::vector<program_load_statistics>
+read_program_load_statistics(const bpf_object* obj, const verifier_logs& logs)
+{
+    std::vector<program_load_statistics> programs;
+    const std::regex processed_instructions_pattern("processed (\\d+) insns");
+    const std::regex verification_time_pattern("verification time (\\d+) usec");
+
+    bpf_program* program;
+    size_t index = 0;
+    bpf_object__for_each_program(program, obj)
+    {
+        program_load_statistics statistics;
+        statistics.name = bpf_program__name(program);
+
+        if (index < logs.size()) {
+            std::string log(logs[index].data());
+            std::smatch match;
+            if (std::regex_search(log, match, processed_instructions_pattern)) {
+                statistics.processed_instructions = std::stoull(match[1]);
+            }
+            if (std::regex_search(log, match, verification_time_pattern)) {
+                statistics.verification_time = std::stoull(match[1]) * 1000;
+            }
+        }
+        index++;
+
+#if defined(__linux__)
+        bpf_prog_info info = {};
+        uint32_t info_length = sizeof(info);
+        if (bpf_obj_get_info_by_fd(bpf_program__fd(program), &info, &info_length) < 0) {
+            throw std::runtime_error("Failed to get the info of program " + statistics.name);
+        }
+        statistics.xlated_length = info.xlated_prog_len;
+        // Programs that aren't JIT compiled report no JIT length.
+        if (info.jited_prog_len > 0) {
+            statistics.jited_length = info.jited_prog_len;
+        }
+#endif
+        programs.push_back(statistics);
+    }
+    return programs;
+}
+
+std::vector<std::pair<std::string, uint64_t>>
+load_statistics_rows(const object_load_statistics& statistics)
+{
+    std::vector<std::pair<std::string, uint64_t>> rows = {
+        {statistics.object_name + " open", statistics.open_time},
+        {statistics.object_name + " load", statistics.load_time}};
+    for (const auto& program : statistics.programs) {
+        std::string prefix = statistics.object_name + " " + program.name;
+        if (program.verification_time.has_value()) {
+            rows.push_back({prefix + " verification", *program.verification_time});
+        }
+        if (program.processed_instructions.has_value()) {
+            rows.push_back({prefix + " processed insns", *program.processed_instructions});
+        }
+        if (program.xlated_length.has_value()) {
+            rows.push_back({prefix + " xlated bytes", *program.xlated_length});
+        }
+        if (program.jited_length.has_value()) {
+            rows.push_back({prefix + " jited bytes", *program.jited_length});
+        }
+    }
+    return rows;
+}
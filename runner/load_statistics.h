@@ -0,0 +1,49 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <bpf/libbpf.h>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Cost of loading a program, as reported by the verifier and by the program info. Values that the platform or the
+// libbpf version doesn't provide are left empty.
+struct program_load_statistics
+{
+    std::string name;
+    // Instructions the verifier processed and the time it spent verifying the program, in nanoseconds.
+    std::optional<uint64_t> processed_instructions;
+    std::optional<uint64_t> verification_time;
+    // Size of the program after the verifier rewrote it and after it was JIT compiled, in bytes.
+    std::optional<uint32_t> xlated_length;
+    std::optional<uint32_t> jited_length;
+};
+
+// Cost of opening and loading a BPF object, in nanoseconds, and of loading each of its programs.
+struct object_load_statistics
+{
+    std::string object_name;
+    uint64_t open_time = 0;
+    uint64_t load_time = 0;
+    std::vector<program_load_statistics> programs;
+};
+
+// Buffers the verifier writes its statistics on each program into, which must outlive loading the object.
+using verifier_logs = std::vector<std::vector<char>>;
+
+// Ask the verifier for its statistics on each program of an opened object. Returns no buffers when the platform or the
+// libbpf version doesn't support it.
+verifier_logs
+request_verifier_statistics(bpf_object* obj);
+
+// Read the load statistics of each program of a loaded object from the verifier logs and the program info.
+std::vector<program_load_statistics>
+read_program_load_statistics(const bpf_object* obj, const verifier_logs& logs);
+
+// Return the name and value of the results rows that report the load statistics of an object.
+std::vector<std::pair<std::string, uint64_t>>
+load_statistics_rows(const object_load_statistics& statistics);
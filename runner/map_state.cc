@@ -0,0 +1,328 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "map_state.h"
+
+#include <algorithm>
+#include <bpf/bpf.h>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+// Number of entries passed to each batch map operation.
+static const size_t update_batch_size = 4096;
+
+void
+store_integer(uint8_t* destination, size_t size, uint64_t value)
+{
+    for (size_t i = 0; i < size; i++) {
+        destination[i] = i < sizeof(value) ? static_cast<uint8_t>(value >> (i * 8)) : 0;
+    }
+}
+
+// Decode a hex string such as "0a000001" into exactly size bytes.
+static std::vector<uint8_t>
+parse_hex(const std::string& hex, size_t size, const std::string& file)
+{
+    if (hex.size() != size * 2) {
+        throw std::runtime_error(
+            "Invalid entry " + hex + " in " + file + ": expected " + std::to_string(size) + " hex encoded bytes");
+    }
+    std::vector<uint8_t> bytes(size);
+    for (size_t i = 0; i < size; i++) {
+        bytes[i] = static_cast<uint8_t>(std::stoul(hex.substr(i * 2, 2), nullptr, 16));
+    }
+    return bytes;
+}
+
+bool
+is_percpu_map(bpf_map_type type)
+{
+    return type == BPF_MAP_TYPE_PERCPU_HASH || type == BPF_MAP_TYPE_PERCPU_ARRAY ||
+           type == BPF_MAP_TYPE_LRU_PERCPU_HASH;
+}
+
+size_t
+map_value_buffer_size(const bpf_map* map)
+{
+    size_t value_size = bpf_map__value_size(map);
+    if (is_percpu_map(bpf_map__type(map))) {
+        // The kernel copies per CPU values as one 8 byte aligned value per possible CPU.
+        return ((value_size + 7) & ~static_cast<size_t>(7)) * libbpf_num_possible_cpus();
+    }
+    return value_size;
+}
+
+map_entries
+generate_map_entries(const bpf_map* map, const map_fill_parameters& parameters)
+{
+    map_entries entries;
+    entries.key_size = bpf_map__key_size(map);
+    entries.value_size = map_value_buffer_size(map);
+    size_t value_size = bpf_map__value_size(map);
+    size_t value_stride = is_percpu_map(bpf_map__type(map)) ? (value_size + 7) & ~static_cast<size_t>(7) : value_size;
+    size_t copies = entries.value_size / value_stride;
+
+    // Store a single value, replicated for each CPU in per CPU maps.
+    auto append_value = [&](const uint8_t* value) {
+        for (size_t copy = 0; copy < copies; copy++) {
+            entries.values.insert(entries.values.end(), value, value + value_size);
+            entries.values.resize(entries.values.size() + value_stride - value_size);
+        }
+    };
+
+    if (parameters.generator == "sequential" || parameters.generator == "random") {
+        size_t count = parameters.count.value_or(bpf_map__max_entries(map));
+        std::mt19937_64 random(parameters.seed);
+        std::vector<uint8_t> key(entries.key_size);
+        std::vector<uint8_t> value(value_size);
+        entries.keys.reserve(count * entries.key_size);
+        entries.values.reserve(count * entries.value_size);
+        for (size_t i = 0; i < count; i++) {
+            if (parameters.generator == "sequential") {
+                store_integer(key.data(), key.size(), i);
+                store_integer(value.data(), value.size(), i);
+            } else {
+                for (auto& byte : key) {
+                    byte = static_cast<uint8_t>(random());
+                }
+                for (auto& byte : value) {
+                    byte = static_cast<uint8_t>(random());
+                }
+            }
+            entries.keys.insert(entries.keys.end(), key.begin(), key.end());
+            append_value(value.data());
+        }
+    } else if (parameters.generator == "file") {
+        std::ifstream input(parameters.file);
+        if (!input) {
+            throw std::runtime_error("Failed to open map state file " + parameters.file);
+        }
+        std::string line;
+        while (std::getline(input, line) && (!parameters.count || entries.count() < *parameters.count)) {
+            std::stringstream fields(line);
+            std::string key_hex;
+            std::string value_hex;
+            if (!(fields >> key_hex) || key_hex[0] == '#') {
+                continue;
+            }
+            fields >> value_hex;
+            auto key = parse_hex(key_hex, entries.key_size, parameters.file);
+            auto value = parse_hex(value_hex, value_size, parameters.file);
+            entries.keys.insert(entries.keys.end(), key.begin(), key.end());
+            append_value(value.data());
+        }
+    } else {
+        throw std::runtime_error("Unknown map state generator " + parameters.generator);
+    }
+    return entries;
+}
+
+void
+update_map_entries(int map_fd, const std::string& map_name, map_entries& entries)
+{
+    size_t count = entries.count();
+    size_t updated = 0;
+
+#if defined(HAS_BPF_MAP_BATCH_OPERATIONS)
+    while (updated < count) {
+        uint32_t batch_count = static_cast<uint32_t>(std::min(update_batch_size, count - updated));
+        bpf_map_batch_opts opts;
+        memset(&opts, 0, sizeof(opts));
+        opts.sz = sizeof(opts);
+        int result = bpf_map_update_batch(
+            map_fd,
+            entries.keys.data() + updated * entries.key_size,
+            entries.values.data() + updated * entries.value_size,
+            &batch_count,
+            &opts);
+        if (result < 0) {
+            // Not supported by the kernel or map type, continue with per element updates. The kernel doesn't write
+            // back the count when it rejects the batch before processing it, so redo the whole batch: updates with
+            // BPF_ANY can be repeated.
+            break;
+        }
+        updated += std::min<size_t>(batch_count, count - updated);
+    }
+#endif
+
+    for (; updated < count; updated++) {
+        if (bpf_map_update_elem(
+                map_fd,
+                entries.keys.data() + updated * entries.key_size,
+                entries.values.data() + updated * entries.value_size,
+                BPF_ANY) < 0) {
+            throw std::runtime_error(
+                "Failed to update map " + map_name + " entry " + std::to_string(updated) + ": " + strerror(errno));
+        }
+    }
+}
+
+// Return true if the contents of the map can be read and written back from userspace.
+static bool
+is_restorable_map(const bpf_map* map)
+{
+#if defined(__linux__)
+    // Frozen maps, such as .rodata, can't be written from userspace.
+    if (bpf_map__map_flags(map) & BPF_F_RDONLY_PROG) {
+        return false;
+    }
+#endif
+    switch (bpf_map__type(map)) {
+    case BPF_MAP_TYPE_HASH:
+    case BPF_MAP_TYPE_ARRAY:
+    case BPF_MAP_TYPE_PERCPU_HASH:
+    case BPF_MAP_TYPE_PERCPU_ARRAY:
+    case BPF_MAP_TYPE_LRU_HASH:
+    case BPF_MAP_TYPE_LRU_PERCPU_HASH:
+    case BPF_MAP_TYPE_LPM_TRIE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static bool
+is_array_map(const bpf_map* map)
+{
+    return bpf_map__type(map) == BPF_MAP_TYPE_ARRAY || bpf_map__type(map) == BPF_MAP_TYPE_PERCPU_ARRAY;
+}
+
+// Read all entries of the map with bpf_map_lookup_batch, falling back to iterating over the keys.
+static map_entries
+read_map_entries(const bpf_map* map)
+{
+    int map_fd = bpf_map__fd(map);
+    map_entries entries;
+    entries.key_size = bpf_map__key_size(map);
+    entries.value_size = map_value_buffer_size(map);
+
+#if defined(HAS_BPF_MAP_BATCH_OPERATIONS)
+    // The batch position is opaque: a bucket index for hash maps and a key for other maps.
+    std::vector<uint8_t> in_batch(std::max(entries.key_size, sizeof(uint64_t)));
+    std::vector<uint8_t> out_batch(in_batch.size());
+    bool first_batch = true;
+    for (;;) {
+        size_t count = entries.count();
+        uint32_t batch_count = static_cast<uint32_t>(update_batch_size);
+        entries.keys.resize((count + batch_count) * entries.key_size);
+        entries.values.resize((count + batch_count) * entries.value_size);
+        bpf_map_batch_opts opts;
+        memset(&opts, 0, sizeof(opts));
+        opts.sz = sizeof(opts);
+        int result = bpf_map_lookup_batch(
+            map_fd,
+            first_batch ? nullptr : in_batch.data(),
+            out_batch.data(),
+            entries.keys.data() + count * entries.key_size,
+            entries.values.data() + count * entries.value_size,
+            &batch_count,
+            &opts);
+        int error = errno;
+        if (result < 0 && error != ENOENT) {
+            // Not supported by the kernel or map type, read the entries one at a time instead.
+            entries.keys.clear();
+            entries.values.clear();
+            break;
+        }
+        entries.keys.resize((count + batch_count) * entries.key_size);
+        entries.values.resize((count + batch_count) * entries.value_size);
+        if (result < 0) {
+            // ENOENT marks the end of the map.
+            return entries;
+        }
+        in_batch = out_batch;
+        first_batch = false;
+    }
+#endif
+
+    std::vector<uint8_t> key(entries.key_size);
+    std::vector<uint8_t> value(entries.value_size);
+    bool first_key = true;
+    while (bpf_map_get_next_key(map_fd, first_key ? nullptr : key.data(), key.data()) == 0) {
+        first_key = false;
+        if (bpf_map_lookup_elem(map_fd, key.data(), value.data()) < 0) {
+            // The entry was removed (e.g. evicted from an LRU map) while iterating.
+            continue;
+        }
+        entries.keys.insert(entries.keys.end(), key.begin(), key.end());
+        entries.values.insert(entries.values.end(), value.begin(), value.end());
+    }
+    return entries;
+}
+
+// Remove all entries from a map that supports deletion.
+static void
+clear_map(const bpf_map* map)
+{
+    int map_fd = bpf_map__fd(map);
+    size_t key_size = bpf_map__key_size(map);
+    std::vector<uint8_t> keys;
+    std::vector<uint8_t> key(key_size);
+    bool first_key = true;
+    while (bpf_map_get_next_key(map_fd, first_key ? nullptr : key.data(), key.data()) == 0) {
+        first_key = false;
+        keys.insert(keys.end(), key.begin(), key.end());
+    }
+
+    size_t count = keys.size() / key_size;
+    size_t deleted = 0;
+#if defined(HAS_BPF_MAP_BATCH_OPERATIONS)
+    while (deleted < count) {
+        uint32_t batch_count = static_cast<uint32_t>(std::min(update_batch_size, count - deleted));
+        bpf_map_batch_opts opts;
+        memset(&opts, 0, sizeof(opts));
+        opts.sz = sizeof(opts);
+        int result = bpf_map_delete_batch(map_fd, keys.data() + deleted * key_size, &batch_count, &opts);
+        if (result < 0) {
+            // As with updates, the count isn't reliable on failure. Redo the whole batch one key at a time, which
+            // skips the keys that the batch already deleted.
+            break;
+        }
+        deleted += std::min<size_t>(batch_count, count - deleted);
+    }
+#endif
+
+    for (; deleted < count; deleted++) {
+        // Entries may already be gone, e.g. evicted from an LRU map.
+        if (bpf_map_delete_elem(map_fd, keys.data() + deleted * key_size) < 0 && errno != ENOENT) {
+            throw std::runtime_error("Failed to delete entry from map " + std::string(bpf_map__name(map)) + ": " +
+                                     strerror(errno));
+        }
+    }
+}
+
+map_state_snapshot
+snapshot_map_state(const bpf_object* obj)
+{
+    map_state_snapshot snapshot;
+    bpf_map* map;
+    bpf_object__for_each_map(map, obj)
+    {
+        if (is_restorable_map(map)) {
+            snapshot[bpf_map__name(map)] = read_map_entries(map);
+        }
+    }
+    return snapshot;
+}
+
+void
+restore_map_state(const bpf_object* obj, map_state_snapshot& snapshot)
+{
+    bpf_map* map;
+    bpf_object__for_each_map(map, obj)
+    {
+        auto entries = snapshot.find(bpf_map__name(map));
+        if (entries == snapshot.end()) {
+            continue;
+        }
+        // Array entries can't be deleted, but every entry of an array is part of the snapshot.
+        if (!is_array_map(map)) {
+            clear_map(map);
+        }
+        update_map_entries(bpf_map__fd(map), entries->first, entries->second);
+    }
+}
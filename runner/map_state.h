@@ -0,0 +1,79 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <bpf/libbpf.h>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+// How the entries of a map are generated when the map is filled from userspace.
+struct map_fill_parameters
+{
+    // One of:
+    // - sequential: keys and values 0, 1, 2, ... stored as little-endian integers of the key and value size.
+    // - random: random keys and values.
+    // - file: entries read from a file, one per line as a hex encoded key and value separated by whitespace.
+    std::string generator = "sequential";
+    // Number of entries to generate. Defaults to the max_entries of the map, or all entries of the file.
+    std::optional<size_t> count;
+    // Path of the file used by the file generator.
+    std::string file;
+    // Seed of the random generator.
+    uint64_t seed = 0;
+};
+
+// Entries of a map, with the keys and values stored contiguously as expected by the batch map operations.
+// For per CPU maps each value holds one 8 byte aligned copy of the value per possible CPU.
+struct map_entries
+{
+    size_t key_size = 0;
+    size_t value_size = 0;
+    std::vector<uint8_t> keys;
+    std::vector<uint8_t> values;
+
+    size_t
+    count() const
+    {
+        return key_size ? keys.size() / key_size : 0;
+    }
+};
+
+// Return true if maps of this type hold one copy of each value per possible CPU.
+bool
+is_percpu_map(bpf_map_type type);
+
+// Return the size of the buffer that holds a single value of the map, accounting for per CPU maps.
+size_t
+map_value_buffer_size(const bpf_map* map);
+
+// Store value as a little-endian integer of the given size, truncating or zero extending it. This is how the sequential
+// generator, the background workloads and the userspace benchmarks encode the keys and values of a map.
+void
+store_integer(uint8_t* destination, size_t size, uint64_t value);
+
+// Generate the entries used to fill the map.
+map_entries
+generate_map_entries(const bpf_map* map, const map_fill_parameters& parameters);
+
+// Insert the entries into the map with bpf_map_update_batch, falling back to per element updates if batch
+// operations aren't supported by the platform, the kernel or the map type.
+void
+update_map_entries(int map_fd, const std::string& map_name, map_entries& entries);
+
+// Contents of every map of a BPF object that holds state, keyed by map name.
+typedef std::map<std::string, map_entries> map_state_snapshot;
+
+// Read the contents of all maps of the object whose contents can be restored: hash, array and LPM trie maps,
+// including their per CPU and LRU variants. Maps of maps, program arrays, ring buffers and read-only maps are
+// skipped.
+map_state_snapshot
+snapshot_map_state(const bpf_object* obj);
+
+// Restore the contents of the maps of the object to the snapshot, removing entries added since it was taken.
+void
+restore_map_state(const bpf_object* obj, map_state_snapshot& snapshot);
@@ -0,0 +1,182 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "ring_buffer_consumer.h"
+
+#include "cpu_affinity.h"
+
+#include <cerrno>
+#include <cstring>
+#include <random>
+#include <stdexcept>
+
+#if defined(__linux__)
+#include <time.h>
+#endif
+
+// Maximum number of latency samples kept per run. Records beyond it replace samples at random, so that the samples
+// are spread uniformly over the run.
+static const size_t max_latency_samples = 1 << 20;
+
+// Timeout of each poll, after which the consumer checks whether it was asked to stop.
+static const int poll_timeout_ms = 10;
+
+ring_buffer_consumer::ring_buffer_consumer(const bpf_object* obj, const ring_buffer_consumer_parameters& parameters)
+    : parameters(parameters)
+{
+#if defined(__linux__)
+    if (parameters.mode != "epoll" && parameters.mode != "busy_poll") {
+        throw std::runtime_error("Unknown ring buffer consumer mode " + parameters.mode);
+    }
+    auto map = bpf_object__find_map_by_name(obj, parameters.map_name.c_str());
+    if (!map) {
+        throw std::runtime_error("Failed to find map " + parameters.map_name);
+    }
+    if (bpf_map__type(map) == BPF_MAP_TYPE_PERF_EVENT_ARRAY) {
+        perf_buffer = perf_buffer__new(
+            bpf_map__fd(map), parameters.perf_buffer_pages, handle_perf_record, nullptr, this, nullptr);
+        if (!perf_buffer) {
+            throw std::runtime_error("Failed to create perf buffer consumer for map " + parameters.map_name);
+        }
+    } else {
+        ring_buffer = ring_buffer__new(bpf_map__fd(map), handle_record, this, nullptr);
+        if (!ring_buffer) {
+            throw std::runtime_error("Failed to create ring buffer consumer for map " + parameters.map_name);
+        }
+    }
+#else
+    throw std::runtime_error("Ring buffer consumers are only supported on Linux");
+#endif
+}
+
+ring_buffer_consumer::~ring_buffer_consumer()
+{
+    if (thread.joinable()) {
+        thread.request_stop();
+        thread.join();
+    }
+#if defined(__linux__)
+    if (ring_buffer) {
+        ring_buffer__free(ring_buffer);
+    }
+    if (perf_buffer) {
+        perf_buffer__free(perf_buffer);
+    }
+#endif
+}
+
+int
+ring_buffer_consumer::handle_record(void* context, void* data, size_t size)
+{
+    auto consumer = static_cast<ring_buffer_consumer*>(context);
+    if (!consumer->counting) {
+        return 0;
+    }
+    consumer->result.record_count++;
+    consumer->result.byte_count += size;
+
+#if defined(__linux__)
+    if (consumer->parameters.latency && size >= sizeof(uint64_t)) {
+        // bpf_ktime_get_ns reads CLOCK_MONOTONIC.
+        timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        uint64_t produced;
+        memcpy(&produced, data, sizeof(produced));
+        uint64_t consumed = static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+        double latency = consumed > produced ? static_cast<double>(consumed - produced) : 0;
+
+        // Reservoir sampling of the latencies.
+        auto& samples = consumer->result.latency_samples;
+        uint64_t index = consumer->latency_record_count++;
+        if (samples.size() < max_latency_samples) {
+            samples.push_back(latency);
+        } else {
+            static std::mt19937_64 random;
+            uint64_t slot = std::uniform_int_distribution<uint64_t>(0, index)(random);
+            if (slot < max_latency_samples) {
+                samples[slot] = latency;
+            }
+        }
+    }
+#endif
+    return 0;
+}
+
+void
+ring_buffer_consumer::handle_perf_record(void* context, int cpu, void* data, uint32_t size)
+{
+    (void)handle_record(context, data, size);
+}
+
+int
+ring_buffer_consumer::consume()
+{
+#if defined(__linux__)
+    return perf_buffer ? perf_buffer__consume(perf_buffer) : ring_buffer__consume(ring_buffer);
+#else
+    return 0;
+#endif
+}
+
+int
+ring_buffer_consumer::poll(int timeout_ms)
+{
+#if defined(__linux__)
+    return perf_buffer ? perf_buffer__poll(perf_buffer, timeout_ms) : ring_buffer__poll(ring_buffer, timeout_ms);
+#else
+    return 0;
+#endif
+}
+
+void
+ring_buffer_consumer::start()
+{
+#if defined(__linux__)
+    // Discard the records left behind by earlier runs, such as the calibration of the test.
+    counting = false;
+    (void)consume();
+
+    result = ring_buffer_consumer_result();
+    latency_record_count = 0;
+    counting = true;
+    thread = std::jthread([this](std::stop_token stop_token) { run(stop_token); });
+#endif
+}
+
+ring_buffer_consumer_result
+ring_buffer_consumer::stop()
+{
+    thread.request_stop();
+    thread.join();
+    counting = false;
+    return result;
+}
+
+void
+ring_buffer_consumer::run(std::stop_token stop_token)
+{
+#if defined(__linux__)
+    if (parameters.cpu.has_value()) {
+        (void)pin_current_thread_to_cpu(*parameters.cpu);
+    }
+
+    // perf_buffer__consume doesn't return the number of records, so progress is measured by the record count.
+    while (!stop_token.stop_requested()) {
+        uint64_t record_count = result.record_count;
+        int error = parameters.mode == "busy_poll" ? consume() : poll(poll_timeout_ms);
+        if (error < 0 && error != -EINTR) {
+            break;
+        }
+        if (result.record_count != record_count) {
+            result.end_time = std::chrono::steady_clock::now();
+        }
+    }
+
+    // Drain the records produced before the consumer was asked to stop.
+    uint64_t record_count = result.record_count;
+    (void)consume();
+    if (result.record_count != record_count) {
+        result.end_time = std::chrono::steady_clock::now();
+    }
+#endif
+}
@@ -0,0 +1,86 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <bpf/libbpf.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// How a userspace consumer drains a BPF_MAP_TYPE_RINGBUF or BPF_MAP_TYPE_PERF_EVENT_ARRAY while the programs of a
+// test produce into it.
+struct ring_buffer_consumer_parameters
+{
+    // Name of the ring buffer or perf event array map.
+    std::string map_name;
+    // One of:
+    // - epoll: wait for records with ring_buffer__poll (or perf_buffer__poll), which sleeps until the producers wake
+    //   the consumer up.
+    // - busy_poll: spin on ring_buffer__consume (or perf_buffer__consume) without sleeping.
+    std::string mode = "epoll";
+    // Number of pages of the buffer of each CPU of a perf event array. Must be a power of 2.
+    size_t perf_buffer_pages = 64;
+    // CPU to pin the consumer to, if any.
+    std::optional<int> cpu;
+    // True if each record starts with the bpf_ktime_get_ns time at which it was produced, to measure the latency.
+    bool latency = false;
+};
+
+// Records consumed while the consumer was running.
+struct ring_buffer_consumer_result
+{
+    uint64_t record_count = 0;
+    uint64_t byte_count = 0;
+    // Time at which the consumer had drained the last record.
+    std::chrono::steady_clock::time_point end_time;
+    // Producer to consumer latency of a uniform sample of the records, in nanoseconds.
+    std::vector<double> latency_samples;
+};
+
+// Userspace thread that consumes the records of a ring buffer or perf event array of a BPF object (Linux only).
+class ring_buffer_consumer
+{
+  public:
+    ring_buffer_consumer(const bpf_object* obj, const ring_buffer_consumer_parameters& parameters);
+    ~ring_buffer_consumer();
+
+    // Discard the records already in the ring buffer and start consuming.
+    void
+    start();
+
+    // Stop consuming once the records produced so far have been drained, and return what was consumed.
+    ring_buffer_consumer_result
+    stop();
+
+  private:
+    static int
+    handle_record(void* context, void* data, size_t size);
+
+    static void
+    handle_perf_record(void* context, int cpu, void* data, uint32_t size);
+
+    // Consume whatever records are available, returning a negative error on failure.
+    int
+    consume();
+
+    // Wait up to timeout_ms for records and consume them, returning a negative error on failure.
+    int
+    poll(int timeout_ms);
+
+    void
+    run(std::stop_token stop_token);
+
+    ring_buffer_consumer_parameters parameters;
+    struct ring_buffer* ring_buffer = nullptr;
+    struct perf_buffer* perf_buffer = nullptr;
+    // Records are discarded rather than counted while not started.
+    bool counting = false;
+    uint64_t latency_record_count = 0;
+    ring_buffer_consumer_result result;
+    std::jthread thread;
+};
@@ -1,14 +1,32 @@
 // Copyright (c) Microsoft Corporation
 // SPDX-License-Identifier: MIT
 
+#include "background_workload.h"
+#include "cpu_affinity.h"
+#include "execution_backend.h"
+#include "hardware_counters.h"
+#include "key_distribution.h"
+#include "latency_histogram.h"
+#include "load_statistics.h"
+#include "map_state.h"
 #include "options.h"
+#include "ring_buffer_consumer.h"
+#include "statistics.h"
+#include "user_ring_buffer_producer.h"
+#include "userspace_benchmark.h"
 #include <bpf/bpf.h>
 #include <bpf/libbpf.h>
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <exception>
 #include <iomanip>
 #include <iostream>
+#include <latch>
+#include <limits>
 #include <optional>
 #include <regex>
+#include <set>
 #include <sstream>
 #include <thread>
 #include <vector>
@@ -30,6 +48,7 @@ typedef std::unique_ptr<struct bpf_object, bpf_object_deleter> bpf_object_ptr;
 
 // Set string runner_platform to "linux" to indicate that this is a Linux runner.
 #if defined(__linux__)
+#include <bpf/btf.h>
 const std::string runner_platform = "Linux";
 #define time_t_to_utc_tm(TM, TIME) gmtime_r(TIME, TM)
 #define DEFAULT_PROG_TYPE BPF_PROG_TYPE_XDP
@@ -76,20 +95,1291 @@ std::string to_iso8601(const std::chrono::system_clock::time_point tp)
     return ss.str();
 }
 
+// Join a set of fields into a single CSV line.
+std::string
+join_csv(const std::vector<std::string>& fields)
+{
+    std::string line;
+    for (size_t i = 0; i < fields.size(); i++) {
+        if (i > 0) {
+            line += ",";
+        }
+        line += fields[i];
+    }
+    return line;
+}
+
+// Names of the summary statistics columns reported when a test is run for multiple trials.
+const std::vector<std::string> trial_statistics_columns = {
+    "Min", "Median", "Mean", "Stddev", "P95", "CI95 Low", "CI95 High"};
+
+// Format a floating point value for the CSV output.
+std::string
+format_double(double value)
+{
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(2) << value;
+    return ss.str();
+}
+
+// Parameters that describe how each program is invoked via bpf_prog_test_run_opts.
+struct test_run_parameters
+{
+    int repeat;
+    bool pass_data;
+    bool pass_context;
+    int batch_size;
+    // Count hardware events around each run with perf_event_open.
+    bool hardware_counters = false;
+    // Backend that runs the programs.
+    execution_backend* backend = nullptr;
+};
+
+// Outcome of running the assigned programs concurrently on their CPUs.
+struct test_run_result
+{
+    // The completed bpf_test_run_opts for each CPU. Entries for unassigned CPUs are zeroed.
+    std::vector<bpf_test_run_opts> opts;
+    // Time at which all workers were released from the start barrier.
+    std::chrono::steady_clock::time_point start_time;
+    // Time at which the first and the last worker finished.
+    std::chrono::steady_clock::time_point first_end_time;
+    std::chrono::steady_clock::time_point last_end_time;
+    // Total number of program invocations across all CPUs.
+    uint64_t total_iterations = 0;
+    // Hardware counters of each CPU, if requested. Empty for userspace tests.
+    std::vector<hardware_counter_values> counters;
+
+    // Wall-clock window during which every assigned CPU was running the test.
+    std::chrono::nanoseconds
+    concurrent_window() const
+    {
+        return first_end_time - start_time;
+    }
+
+    // Invocations per second across all CPUs, from the release of the workers until the last one finished.
+    double
+    aggregate_throughput() const
+    {
+        auto elapsed = std::chrono::duration<double>(last_end_time - start_time).count();
+        return elapsed > 0 ? total_iterations / elapsed : 0;
+    }
+};
+
+// Run each assigned program on its CPU via the test run of the backend, using one thread per CPU.
+// Each worker is pinned to its CPU and waits on a shared barrier, so that all CPUs start the test together and
+// contention between them is measured from the first iteration.
+test_run_result
+run_test_programs(
+    const std::vector<std::optional<int>>& cpu_program_assignments, const test_run_parameters& parameters)
+{
+    std::vector<std::jthread> threads;
+    test_run_result result;
+    result.opts.resize(cpu_program_assignments.size());
+    std::vector<std::chrono::steady_clock::time_point> end_times(cpu_program_assignments.size());
+    std::vector<char> pinned(cpu_program_assignments.size(), true);
+    auto& counter_values = result.counters;
+    if (parameters.hardware_counters) {
+        counter_values.resize(cpu_program_assignments.size());
+    }
+
+    ptrdiff_t worker_count = std::count_if(
+        cpu_program_assignments.begin(), cpu_program_assignments.end(), [](auto& a) { return a.has_value(); });
+    std::latch workers_ready(worker_count);
+    std::latch start_test(1);
+
+    for (size_t i = 0; i < cpu_program_assignments.size(); i++) {
+        auto& opt = result.opts[i];
+        memset(&opt, 0, sizeof(opt));
+        if (!cpu_program_assignments[i].has_value()) {
+            continue;
+        }
+        auto program = cpu_program_assignments[i].value();
+
+        threads.emplace_back([=, &opt, &counter_values, &end_times, &pinned, &workers_ready, &start_test](
+                                 std::stop_token stop_token) {
+            std::vector<uint8_t> data_in(1024);
+            std::vector<uint8_t> data_out(1024);
+
+            opt.sz = sizeof(opt);
+            opt.repeat = parameters.repeat;
+            opt.cpu = static_cast<uint32_t>(i);
+            if (parameters.pass_data) {
+                opt.data_in = data_in.data();
+                opt.data_out = data_out.data();
+                opt.data_size_in = static_cast<uint32_t>(data_in.size());
+                opt.data_size_out = static_cast<uint32_t>(data_out.size());
+            }
+            if (parameters.pass_context) {
+                opt.ctx_in = data_in.data();
+                opt.ctx_out = data_out.data();
+                opt.ctx_size_in = static_cast<uint32_t>(data_in.size());
+                opt.ctx_size_out = static_cast<uint32_t>(data_out.size());
+            }
+#if defined(HAS_BPF_TEST_RUN_OPTS_BATCH_SIZE)
+            opt.batch_size = parameters.batch_size;
+#endif
+            pinned[i] = pin_current_thread_to_cpu(i);
+            std::optional<hardware_counters> counters;
+            if (parameters.hardware_counters) {
+                counters.emplace(static_cast<int>(i));
+            }
+
+            workers_ready.count_down();
+            start_test.wait();
+
+            if (counters) {
+                counters->start();
+            }
+            int result = parameters.backend->test_run(program, &opt);
+            if (counters) {
+                counter_values[i] = counters->stop();
+            }
+            end_times[i] = std::chrono::steady_clock::now();
+            if (result < 0) {
+                opt.retval = result;
+            }
+        });
+    }
+
+    // Release all workers at once.
+    workers_ready.wait();
+    result.start_time = std::chrono::steady_clock::now();
+    start_test.count_down();
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    result.first_end_time = std::chrono::steady_clock::time_point::max();
+    result.last_end_time = result.start_time;
+    for (size_t i = 0; i < cpu_program_assignments.size(); i++) {
+        if (!cpu_program_assignments[i].has_value()) {
+            continue;
+        }
+        // CPUs that are possible but not online can't be pinned to. Warn once and let the test run unpinned.
+        static std::set<size_t> unpinned_cpus;
+        if (!pinned[i] && unpinned_cpus.insert(i).second) {
+            std::cerr << "Warning: Failed to pin thread to CPU " << i << std::endl;
+        }
+        result.first_end_time = std::min(result.first_end_time, end_times[i]);
+        result.last_end_time = std::max(result.last_end_time, end_times[i]);
+        result.total_iterations += parameters.repeat;
+    }
+    if (worker_count == 0) {
+        result.first_end_time = result.start_time;
+    }
+    return result;
+}
+
+// Run time statistics that the kernel keeps for programs while BPF_STATS_RUN_TIME is enabled.
+struct program_run_statistics
+{
+    uint64_t run_time_ns = 0;
+    uint64_t run_count = 0;
+};
+
+// Sum the run time statistics of the distinct programs assigned to CPUs (Linux only).
+program_run_statistics
+read_program_run_statistics(const std::vector<std::optional<int>>& cpu_program_assignments)
+{
+    program_run_statistics statistics;
+#if defined(__linux__)
+    std::set<int> program_fds;
+    for (const auto& program_fd : cpu_program_assignments) {
+        if (program_fd.has_value() && *program_fd >= 0) {
+            program_fds.insert(*program_fd);
+        }
+    }
+    for (int program_fd : program_fds) {
+        bpf_prog_info info = {};
+        uint32_t info_length = sizeof(info);
+        if (bpf_obj_get_info_by_fd(program_fd, &info, &info_length) < 0) {
+            throw std::runtime_error("Failed to get the run time statistics of a program");
+        }
+        statistics.run_time_ns += info.run_time_ns;
+        statistics.run_count += info.run_cnt;
+    }
+#endif
+    return statistics;
+}
+
+// Number of iterations of each round of the programs that run concurrently with a userspace test.
+const int concurrent_program_iteration_count = 100000;
+
+// Run a userspace map benchmark on a thread pinned to the given CPU, reporting the mean duration of an element
+// operation as the duration of that CPU. The programs assigned to other CPUs, if any, run in rounds for as long as the
+// benchmark does, so that they modify the maps concurrently.
+test_run_result
+run_userspace_test(
+    const bpf_object* obj,
+    userspace_benchmark_parameters parameters,
+    int cpu,
+    int cpu_count,
+    int element_count,
+    const std::vector<std::optional<int>>& concurrent_programs,
+    const test_run_parameters& concurrent_program_parameters)
+{
+    std::jthread programs;
+    if (std::any_of(concurrent_programs.begin(), concurrent_programs.end(), [](auto& a) { return a.has_value(); })) {
+        test_run_parameters round_parameters = concurrent_program_parameters;
+        round_parameters.repeat = concurrent_program_iteration_count;
+        programs = std::jthread([&concurrent_programs, round_parameters](std::stop_token stop_token) {
+            while (!stop_token.stop_requested()) {
+                run_test_programs(concurrent_programs, round_parameters);
+            }
+        });
+    }
+
+    parameters.element_count = element_count;
+    userspace_benchmark_result benchmark_result;
+    bool pinned = true;
+    std::exception_ptr error;
+    std::jthread thread([&]() {
+        pinned = pin_current_thread_to_cpu(cpu);
+        try {
+            benchmark_result = run_userspace_benchmark(obj, parameters);
+        } catch (...) {
+            error = std::current_exception();
+        }
+    });
+    thread.join();
+    if (programs.joinable()) {
+        programs.request_stop();
+        programs.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    if (!pinned) {
+        std::cerr << "Warning: Failed to pin thread to CPU " << cpu << std::endl;
+    }
+
+    test_run_result result;
+    result.opts.resize(cpu_count);
+    for (auto& opt : result.opts) {
+        memset(&opt, 0, sizeof(opt));
+    }
+    auto& opt = result.opts[cpu];
+    opt.sz = sizeof(opt);
+    opt.repeat = element_count;
+    opt.cpu = static_cast<uint32_t>(cpu);
+    uint64_t elements = std::max<uint64_t>(benchmark_result.element_count, 1);
+    opt.duration = static_cast<uint32_t>(benchmark_result.duration.count() / elements);
+
+    result.last_end_time = std::chrono::steady_clock::now();
+    result.first_end_time = result.last_end_time;
+    result.start_time = result.last_end_time - benchmark_result.duration;
+    result.total_iterations = benchmark_result.element_count;
+    return result;
+}
+
+// Parse a flags value, which is either a number or a list of flag names separated by "|", such as
+// "BPF_F_NO_PREALLOC | BPF_F_ZERO_SEED".
+uint32_t
+parse_flags(const std::string& value, const std::map<std::string, uint32_t>& flag_names)
+{
+    uint32_t flags = 0;
+    std::stringstream ss(value);
+    std::string flag;
+    while (std::getline(ss, flag, '|')) {
+        flag.erase(0, flag.find_first_not_of(" \t"));
+        flag.erase(flag.find_last_not_of(" \t") + 1);
+        auto name = flag_names.find(flag);
+        if (name != flag_names.end()) {
+            flags |= name->second;
+        } else if (std::regex_match(flag, std::regex("^(0x[0-9a-fA-F]+|[0-9]+)$"))) {
+            flags |= static_cast<uint32_t>(std::stoul(flag, nullptr, 0));
+        } else {
+            throw std::runtime_error("Unknown flag " + flag);
+        }
+    }
+    return flags;
+}
+
+#if defined(__linux__)
+// Names of the flags that can be used in the map_flags field of a map override.
+const std::map<std::string, uint32_t> map_flag_names = {
+    {"BPF_F_NO_PREALLOC", BPF_F_NO_PREALLOC},
+    {"BPF_F_NO_COMMON_LRU", BPF_F_NO_COMMON_LRU},
+    {"BPF_F_NUMA_NODE", BPF_F_NUMA_NODE},
+    {"BPF_F_RDONLY", BPF_F_RDONLY},
+    {"BPF_F_WRONLY", BPF_F_WRONLY},
+    {"BPF_F_ZERO_SEED", BPF_F_ZERO_SEED},
+    {"BPF_F_RDONLY_PROG", BPF_F_RDONLY_PROG},
+    {"BPF_F_WRONLY_PROG", BPF_F_WRONLY_PROG},
+    {"BPF_F_MMAPABLE", BPF_F_MMAPABLE},
+    {"BPF_F_INNER_MAP", BPF_F_INNER_MAP},
+};
+
+// Apply the map overrides of a test to an opened, but not yet loaded, BPF object.
+// Each entry is a map name and any of max_entries, map_flags, key_size, value_size and numa_node.
+void
+apply_map_overrides(bpf_object* obj, const YAML::Node& maps)
+{
+    for (auto entry : maps) {
+        auto map_name = entry.first.as<std::string>();
+        auto map = bpf_object__find_map_by_name(obj, map_name.c_str());
+        if (!map) {
+            throw std::runtime_error("Failed to find map " + map_name);
+        }
+        if (!entry.second.IsMap()) {
+            throw std::runtime_error("Field maps." + map_name + " must be a map");
+        }
+
+        std::optional<uint32_t> numa_node;
+        for (auto field : entry.second) {
+            auto field_name = field.first.as<std::string>();
+            int result;
+            if (field_name == "max_entries") {
+                result = bpf_map__set_max_entries(map, field.second.as<uint32_t>());
+            } else if (field_name == "map_flags") {
+                result = bpf_map__set_map_flags(map, parse_flags(field.second.as<std::string>(), map_flag_names));
+            } else if (field_name == "key_size") {
+                result = bpf_map__set_key_size(map, field.second.as<uint32_t>());
+            } else if (field_name == "value_size") {
+                result = bpf_map__set_value_size(map, field.second.as<uint32_t>());
+            } else if (field_name == "numa_node") {
+                // Applied last, as the node is only honored together with BPF_F_NUMA_NODE.
+                numa_node = field.second.as<uint32_t>();
+                continue;
+            } else {
+                throw std::runtime_error("Unknown field maps." + map_name + "." + field_name);
+            }
+            if (result < 0) {
+                throw std::runtime_error(
+                    "Failed to set " + field_name + " of map " + map_name + ": " + strerror(-result));
+            }
+        }
+
+        if (numa_node.has_value()) {
+            if (bpf_map__set_numa_node(map, *numa_node) < 0 ||
+                bpf_map__set_map_flags(map, bpf_map__map_flags(map) | BPF_F_NUMA_NODE) < 0) {
+                throw std::runtime_error("Failed to set numa_node of map " + map_name);
+            }
+        }
+    }
+}
+
+// Set the initial value of global variables, such as the "volatile const" configuration of a program in .rodata,
+// of an opened, but not yet loaded, BPF object. Each entry is a variable name and an integer value.
+void
+apply_global_overrides(bpf_object* obj, const YAML::Node& globals)
+{
+    std::map<std::string, YAML::Node> remaining;
+    for (auto entry : globals) {
+        remaining[entry.first.as<std::string>()] = entry.second;
+    }
+
+    auto btf = bpf_object__btf(obj);
+    if (!btf) {
+        throw std::runtime_error("Field globals requires a BPF object with BTF");
+    }
+
+    // Global variables live in internal maps (.data, .rodata, .bss) whose BTF value type describes their layout.
+    bpf_map* map;
+    bpf_object__for_each_map(map, obj)
+    {
+        if (!bpf_map__is_internal(map)) {
+            continue;
+        }
+        auto datasec = btf__type_by_id(btf, bpf_map__btf_value_type_id(map));
+        if (!datasec || !btf_is_datasec(datasec)) {
+            continue;
+        }
+        size_t data_size = 0;
+        auto data = static_cast<uint8_t*>(bpf_map__initial_value(map, &data_size));
+        if (!data) {
+            continue;
+        }
+
+        auto variables = btf_var_secinfos(datasec);
+        for (int i = 0; i < btf_vlen(datasec); i++) {
+            auto variable_type = btf__type_by_id(btf, variables[i].type);
+            auto global = remaining.find(btf__name_by_offset(btf, variable_type->name_off));
+            if (global == remaining.end()) {
+                continue;
+            }
+            auto offset = variables[i].offset;
+            auto size = variables[i].size;
+            if (offset + size > data_size || (size != 1 && size != 2 && size != 4 && size != 8)) {
+                throw std::runtime_error("Global variable " + global->first + " must be an integer");
+            }
+            uint64_t value = global->second.as<uint64_t>();
+            switch (size) {
+            case 1:
+                *reinterpret_cast<uint8_t*>(data + offset) = static_cast<uint8_t>(value);
+                break;
+            case 2:
+                *reinterpret_cast<uint16_t*>(data + offset) = static_cast<uint16_t>(value);
+                break;
+            case 4:
+                *reinterpret_cast<uint32_t*>(data + offset) = static_cast<uint32_t>(value);
+                break;
+            default:
+                *reinterpret_cast<uint64_t*>(data + offset) = value;
+                break;
+            }
+            remaining.erase(global);
+        }
+    }
+
+    if (!remaining.empty()) {
+        throw std::runtime_error("Failed to find global variable " + remaining.begin()->first);
+    }
+}
+#endif
+
+// Return the number of keys the key_distribution of a test ranges over: its key_count, which defaults to the number of
+// entries of the map being accessed.
+uint32_t
+key_distribution_key_count(bpf_object* obj, const YAML::Node& key_distribution)
+{
+    if (key_distribution["key_count"].IsDefined()) {
+        return key_distribution["key_count"].as<uint32_t>();
+    }
+    std::string map_name = key_distribution["map"].IsDefined() ? key_distribution["map"].as<std::string>() : "map";
+    auto map = bpf_object__find_map_by_name(obj, map_name.c_str());
+    if (!map) {
+        throw std::runtime_error("Failed to find map " + map_name);
+    }
+    return bpf_map__max_entries(map);
+}
+
+#if defined(__linux__)
+// Largest key table the runner sizes. Each entry holds a key for every possible CPU, so a key table of this size takes
+// 8 MB per CPU.
+static const uint32_t maximum_key_table_size = 1 << 20;
+
+// Grow the key table of an opened, but not yet loaded, BPF object to the number of keys of the key_distribution,
+// rounded up to a power of 2, so that the stream of each CPU spans the whole key range. The operation table that the
+// mixed programs walk in step with the key table is grown with it, and key_table_mask is set to match.
+void
+size_key_table(bpf_object* obj, const YAML::Node& key_distribution)
+{
+    auto key_table = bpf_object__find_map_by_name(obj, "key_table");
+    if (!key_table) {
+        return;
+    }
+
+    uint32_t default_size = bpf_map__max_entries(key_table);
+    uint32_t key_count = key_distribution_key_count(obj, key_distribution);
+    uint32_t table_size = default_size;
+    while (table_size < key_count && table_size < maximum_key_table_size) {
+        table_size *= 2;
+    }
+    if (table_size < key_count) {
+        throw unsupported_by_backend_error(
+            "The " + std::to_string(key_count) + " keys of the test don't fit in a key table of " +
+            std::to_string(maximum_key_table_size) + " entries");
+    }
+    if (table_size == default_size) {
+        return;
+    }
+
+    for (auto map_name : {"key_table", "operation_table"}) {
+        auto map = bpf_object__find_map_by_name(obj, map_name);
+        if (map && bpf_map__set_max_entries(map, table_size) < 0) {
+            throw std::runtime_error("Failed to set max_entries of map " + std::string(map_name));
+        }
+    }
+    YAML::Node globals;
+    globals["key_table_mask"] = table_size - 1;
+    apply_global_overrides(obj, globals);
+}
+#endif
+
+// Return the key_distribution that the key table of a test is filled from, which defaults to uniform keys for the mixed
+// programs of an operation_mix, or an undefined node if the test doesn't use the key table.
+YAML::Node
+key_table_distribution(const YAML::Node& test)
+{
+    if (test["key_distribution"].IsDefined()) {
+        return test["key_distribution"];
+    }
+    if (test["operation_mix"].IsDefined()) {
+        return YAML::Node(YAML::NodeType::Map);
+    }
+    return YAML::Node(YAML::NodeType::Undefined);
+}
+
+// Key the loaded BPF objects are cached under: the ELF file, the map and global overrides it was loaded with and, for
+// tests that use the key table, the keys the key table was sized to.
+std::string
+bpf_object_key(
+    const std::string& elf_file, const YAML::Node& maps, const YAML::Node& globals, const YAML::Node& key_distribution)
+{
+    std::string object_key = elf_file;
+    if (maps || globals) {
+        object_key += "\n" + YAML::Dump(maps) + "\n" + YAML::Dump(globals);
+    }
+    if (key_distribution) {
+        object_key += "\nkey table of ";
+        if (key_distribution["key_count"].IsDefined()) {
+            object_key += key_distribution["key_count"].as<std::string>() + " keys";
+        } else {
+            object_key += key_distribution["map"].IsDefined() ? key_distribution["map"].as<std::string>() : "map";
+        }
+    }
+    return object_key;
+}
+
+// Open and load the BPF object, or return the instance already loaded by a previous test.
+// The map and global variable overrides of the test are applied between opening and loading the object, so that a
+// single ELF file can be loaded with different map sizes and flags. If key_distribution is set, the key table is sized
+// to its keys. Objects are cached per set of overrides and key table size.
+// If load_statistics is set, the cost of opening and loading the object is appended to it when the object is loaded.
+bpf_object*
+load_bpf_object(
+    execution_backend& backend,
+    std::map<std::string, bpf_object_ptr>& bpf_objects,
+    const std::string& elf_file,
+    const std::optional<std::string>& program_type,
+    const YAML::Node& maps = YAML::Node(YAML::NodeType::Undefined),
+    const YAML::Node& globals = YAML::Node(YAML::NodeType::Undefined),
+    const YAML::Node& key_distribution = YAML::Node(YAML::NodeType::Undefined),
+    std::vector<object_load_statistics>* load_statistics = nullptr)
+{
+    std::string object_key = bpf_object_key(elf_file, maps, globals, key_distribution);
+    auto existing = bpf_objects.find(object_key);
+    if (existing != bpf_objects.end()) {
+        return existing->second.get();
+    }
+
+    bpf_object_ptr obj;
+    object_load_statistics statistics;
+    statistics.object_name = elf_file;
+
+    auto open_start = std::chrono::steady_clock::now();
+    obj.reset(bpf_object__open(elf_file.c_str()));
+    std::chrono::duration<double, std::nano> open_duration = std::chrono::steady_clock::now() - open_start;
+    statistics.open_time = static_cast<uint64_t>(open_duration.count());
+    if (!obj) {
+        throw std::runtime_error(
+            "Failed to open BPF object " + elf_file + ": " + strerror(errno) + "/" + std::to_string(errno));
+    }
+
+    bpf_program* program;
+    bpf_object__for_each_program(program, obj.get())
+    {
+        bpf_prog_type prog_type;
+        bpf_attach_type attach_type;
+        if (program_type.has_value()) {
+            // If program_type is specified, use it.
+            if (libbpf_prog_type_by_name(program_type->c_str(), &prog_type, &attach_type) < 0) {
+                throw std::runtime_error("Failed to get program type " + *program_type);
+            }
+        } else {
+            // If program_type is not specified, use DEFAULT_PROG_TYPE.
+            prog_type = DEFAULT_PROG_TYPE;
+            attach_type = DEFAULT_ATTACH_TYPE;
+        }
+        (void)bpf_program__set_type(program, prog_type);
+    }
+
+    if (maps || globals) {
+#if defined(__linux__)
+        if (maps) {
+            apply_map_overrides(obj.get(), maps);
+        }
+        if (globals) {
+            apply_global_overrides(obj.get(), globals);
+        }
+#else
+        throw std::runtime_error("Fields maps and globals are not supported on " + runner_platform);
+#endif
+    }
+
+#if defined(__linux__)
+    // Userspace backends run the global data of the ELF file, so their key table keeps the size it was built with.
+    if (key_distribution && backend.runs_in_kernel()) {
+        size_key_table(obj.get(), key_distribution);
+    }
+#endif
+
+    // The verifier statistics and program info are only available for programs loaded into the kernel.
+    bool read_program_statistics = load_statistics && backend.runs_in_kernel();
+    verifier_logs logs;
+    if (read_program_statistics) {
+        logs = request_verifier_statistics(obj.get());
+    }
+
+    auto load_start = std::chrono::steady_clock::now();
+    backend.load(obj.get(), elf_file);
+    std::chrono::duration<double, std::nano> load_duration = std::chrono::steady_clock::now() - load_start;
+    statistics.load_time = static_cast<uint64_t>(load_duration.count());
+
+    if (load_statistics) {
+        if (read_program_statistics) {
+            statistics.programs = read_program_load_statistics(obj.get(), logs);
+        }
+        load_statistics->push_back(statistics);
+    }
+
+    // Insert into bpf_objects
+    return bpf_objects.insert({object_key, std::move(obj)}).first->second.get();
+}
+
+// Map state captured after running the map state preparation of a test.
+struct prepared_map_state
+{
+    map_state_snapshot snapshot;
+    // Wall-clock time it took to prepare the state, in milliseconds.
+    double preparation_time;
+};
+
+// Fill the maps listed in map_state_preparation.maps from userspace.
+// Each entry names a map and how to generate its entries (see map_fill_parameters).
+void
+fill_maps(execution_backend& backend, bpf_object* obj, const YAML::Node& maps)
+{
+    if (!maps.IsSequence()) {
+        throw std::runtime_error("Field map_state_preparation.maps must be a sequence");
+    }
+
+    for (auto map_fill : maps) {
+        if (!map_fill["name"].IsDefined()) {
+            throw std::runtime_error("Field map_state_preparation.maps.name is required");
+        }
+
+        auto map_name = map_fill["name"].as<std::string>();
+        auto map = bpf_object__find_map_by_name(obj, map_name.c_str());
+        if (!map) {
+            throw std::runtime_error("Failed to find map " + map_name);
+        }
+
+        map_fill_parameters parameters;
+        if (map_fill["generator"].IsDefined()) {
+            parameters.generator = map_fill["generator"].as<std::string>();
+        }
+        if (map_fill["count"].IsDefined()) {
+            parameters.count = map_fill["count"].as<size_t>();
+        }
+        if (map_fill["file"].IsDefined()) {
+            parameters.file = map_fill["file"].as<std::string>();
+        }
+        if (map_fill["seed"].IsDefined()) {
+            parameters.seed = map_fill["seed"].as<uint64_t>();
+        }
+        if (parameters.generator == "file" && parameters.file.empty()) {
+            throw std::runtime_error("Field map_state_preparation.maps.file is required for map " + map_name);
+        }
+
+        auto entries = generate_map_entries(map, parameters);
+        backend.update_map_entries(map, entries);
+    }
+}
+
+// Fill the per CPU key_table of the object with streams of keys drawn from the key_distribution of a test.
+void
+fill_key_table(execution_backend& backend, bpf_object* obj, const YAML::Node& key_distribution)
+{
+    if (!key_distribution.IsMap()) {
+        throw std::runtime_error("Field key_distribution must be a map");
+    }
+
+    auto key_table = bpf_object__find_map_by_name(obj, "key_table");
+    if (!key_table) {
+        throw std::runtime_error("Failed to find map key_table");
+    }
+
+    key_distribution_parameters parameters;
+    if (key_distribution["type"].IsDefined()) {
+        parameters.type = key_distribution["type"].as<std::string>();
+    }
+    parameters.key_count = key_distribution_key_count(obj, key_distribution);
+    if (key_distribution["theta"].IsDefined()) {
+        parameters.theta = key_distribution["theta"].as<double>();
+    }
+    if (key_distribution["hot_set"].IsDefined()) {
+        parameters.hot_set = key_distribution["hot_set"].as<double>();
+    }
+    if (key_distribution["hot_access"].IsDefined()) {
+        parameters.hot_access = key_distribution["hot_access"].as<double>();
+    }
+    if (key_distribution["stride"].IsDefined()) {
+        parameters.stride = key_distribution["stride"].as<uint32_t>();
+    }
+    if (key_distribution["miss_ratio"].IsDefined()) {
+        parameters.miss_ratio = key_distribution["miss_ratio"].as<double>();
+    }
+    if (key_distribution["seed"].IsDefined()) {
+        parameters.seed = key_distribution["seed"].as<uint64_t>();
+    }
+
+    // A stream shorter than the key range would only ever access some of the keys, which changes the working set.
+    size_t table_size = bpf_map__max_entries(key_table);
+    if (parameters.key_count > table_size) {
+        throw unsupported_by_backend_error(
+            "The key table has " + std::to_string(table_size) + " entries, fewer than the " +
+            std::to_string(parameters.key_count) + " keys of the test");
+    }
+
+    // The value of each entry holds one 8 byte aligned key per possible CPU.
+    size_t possible_cpu_count = libbpf_num_possible_cpus();
+    map_entries entries;
+    entries.key_size = sizeof(uint32_t);
+    entries.value_size = map_value_buffer_size(key_table);
+    entries.keys.resize(table_size * entries.key_size);
+    entries.values.resize(table_size * entries.value_size);
+    size_t cpu_stride = entries.value_size / possible_cpu_count;
+    for (size_t cpu = 0; cpu < possible_cpu_count; cpu++) {
+        auto keys = generate_keys(parameters, table_size, cpu, possible_cpu_count);
+        for (size_t i = 0; i < table_size; i++) {
+            memcpy(entries.values.data() + i * entries.value_size + cpu * cpu_stride, &keys[i], sizeof(keys[i]));
+        }
+    }
+    for (uint32_t i = 0; i < table_size; i++) {
+        memcpy(entries.keys.data() + i * entries.key_size, &i, sizeof(i));
+    }
+    backend.update_map_entries(key_table, entries);
+}
+
+// Parse the background_workload of a test, a list of userspace workloads applied to its maps while it runs.
+std::vector<background_workload_parameters>
+parse_background_workload(const YAML::Node& background_workload)
+{
+    if (!background_workload.IsSequence()) {
+        throw std::runtime_error("Field background_workload must be a sequence");
+    }
+
+    std::vector<background_workload_parameters> workloads;
+    for (auto node : background_workload) {
+        if (!node["map"].IsDefined()) {
+            throw std::runtime_error("Field background_workload.map is required");
+        }
+
+        background_workload_parameters parameters;
+        parameters.map_name = node["map"].as<std::string>();
+        if (node["operation"].IsDefined()) {
+            parameters.operation = node["operation"].as<std::string>();
+        }
+        if (node["key_count"].IsDefined()) {
+            parameters.key_count = node["key_count"].as<uint32_t>();
+        }
+        if (node["batch_size"].IsDefined()) {
+            parameters.batch_size = node["batch_size"].as<uint32_t>();
+        }
+        if (node["rate"].IsDefined()) {
+            parameters.rate = node["rate"].as<double>();
+        }
+        if (node["threads"].IsDefined()) {
+            parameters.threads = node["threads"].as<uint32_t>();
+        }
+        workloads.push_back(parameters);
+    }
+    return workloads;
+}
+
+// Operations of the mixed programs, in the order of their values in the operation_table of the object.
+static const std::vector<std::string> operation_names = {"lookup", "update", "delete"};
+
+// Fill the per CPU operation_table of the object with streams of operations in the proportions of the operation_mix
+// of a test, which map operation names to weights. Programs that use it take their keys from the key table, in step
+// with the operations.
+void
+fill_operation_table(execution_backend& backend, bpf_object* obj, const YAML::Node& operation_mix, uint64_t seed)
+{
+    if (!operation_mix.IsMap()) {
+        throw std::runtime_error("Field operation_mix must be a map");
+    }
+
+    auto operation_table = bpf_object__find_map_by_name(obj, "operation_table");
+    if (!operation_table) {
+        throw std::runtime_error("Failed to find map operation_table");
+    }
+
+    std::vector<double> weights(operation_names.size());
+    for (auto operation : operation_mix) {
+        auto name = operation.first.as<std::string>();
+        auto it = std::find(operation_names.begin(), operation_names.end(), name);
+        if (it == operation_names.end()) {
+            throw std::runtime_error("Unknown operation " + name + " in operation_mix");
+        }
+        weights[it - operation_names.begin()] = operation.second.as<double>();
+    }
+
+    // The value of each entry holds one 8 byte aligned operation per possible CPU.
+    size_t table_size = bpf_map__max_entries(operation_table);
+    size_t possible_cpu_count = libbpf_num_possible_cpus();
+    map_entries entries;
+    entries.key_size = sizeof(uint32_t);
+    entries.value_size = map_value_buffer_size(operation_table);
+    entries.keys.resize(table_size * entries.key_size);
+    entries.values.resize(table_size * entries.value_size);
+    size_t cpu_stride = entries.value_size / possible_cpu_count;
+    for (size_t cpu = 0; cpu < possible_cpu_count; cpu++) {
+        auto operations = generate_operations(weights, table_size, cpu, seed);
+        for (size_t i = 0; i < table_size; i++) {
+            memcpy(
+                entries.values.data() + i * entries.value_size + cpu * cpu_stride,
+                &operations[i],
+                sizeof(operations[i]));
+        }
+    }
+    for (uint32_t i = 0; i < table_size; i++) {
+        memcpy(entries.keys.data() + i * entries.key_size, &i, sizeof(i));
+    }
+    backend.update_map_entries(operation_table, entries);
+}
+
+// Assign the programs listed in program_cpu_assignment to CPUs, returning a vector of CPU -> program fd.
+// Only the first active_cpu_count CPUs are used: "all" and "remaining" expand to those CPUs and explicitly
+// listed CPUs beyond them are left unassigned. "any" picks the first CPU that has no program yet, isn't one of the
+// reserved_cpus that run the userspace side of the test and is available to the runner, so that a test that needs a
+// CPU besides its consumer or producer is skipped rather than failing on hosts without one.
+std::vector<std::optional<int>>
+assign_programs_to_cpus(
+    execution_backend& backend,
+    bpf_object* obj,
+    const YAML::Node& program_cpu_assignment,
+    int cpu_count,
+    int active_cpu_count,
+    const std::set<int>& reserved_cpus)
+{
+    std::vector<std::optional<int>> cpu_program_assignments(cpu_count);
+
+    auto assign = [&](int cpu, int program_fd) {
+        if (cpu < 0 || cpu >= cpu_count) {
+            throw std::runtime_error("Invalid CPU number " + std::to_string(cpu));
+        }
+        if (cpu < active_cpu_count) {
+            cpu_program_assignments[cpu] = {program_fd};
+        }
+    };
+
+    for (auto assignment : program_cpu_assignment) {
+        // Each node is a program name and a cpu number or a list of cpu numbers.
+        // First check if program exists and get program fd.
+
+        auto program_name = assignment.first.as<std::string>();
+        auto program = bpf_object__find_program_by_name(obj, program_name.c_str());
+        if (!program) {
+            throw std::runtime_error("Failed to find program " + program_name);
+        }
+
+        int program_fd = backend.program_handle(program);
+
+        // Check if assignment is scalar or sequence
+        if (assignment.second.IsScalar()) {
+            if (assignment.second.as<std::string>() == "all") {
+                // Assign program to all CPUs.
+                for (int i = 0; i < active_cpu_count; i++) {
+                    cpu_program_assignments[i] = {program_fd};
+                }
+            } else if (assignment.second.as<std::string>() == "remaining") {
+                // Assign program to all remaining CPUs.
+                for (int i = 0; i < active_cpu_count; i++) {
+                    if (!cpu_program_assignments[i].has_value()) {
+                        cpu_program_assignments[i] = {program_fd};
+                    }
+                }
+            } else if (assignment.second.as<std::string>() == "any") {
+                int cpu = 0;
+                while (cpu < cpu_count && (cpu_program_assignments[cpu].has_value() || reserved_cpus.contains(cpu) ||
+                                           !cpu_is_available(cpu))) {
+                    cpu++;
+                }
+                if (cpu == cpu_count) {
+                    throw unsupported_by_backend_error("No CPU is left to run program " + program_name + " on");
+                }
+                assign(cpu, program_fd);
+            } else {
+                assign(assignment.second.as<int>(), program_fd);
+            }
+        } else if (assignment.second.IsSequence()) {
+            for (auto cpu_assignment : assignment.second) {
+                assign(cpu_assignment.as<int>(), program_fd);
+            }
+        } else {
+            throw std::runtime_error("Invalid program_cpu_assignment - must be string or sequence");
+        }
+    }
+    return cpu_program_assignments;
+}
+
+// Measure the per CPU overhead of the test harness by running the baseline program on the CPUs the test runs on, using
+// the same invocation shape (pass_data, pass_context, batch_size and iteration count) as the test being measured.
+// The result is the mean duration per CPU across the given number of trials, and zero for the other CPUs.
+std::vector<double>
+measure_baseline(
+    bpf_object* baseline_object,
+    const std::vector<std::optional<int>>& cpu_program_assignments,
+    const test_run_parameters& parameters,
+    int trials)
+{
+    auto program = bpf_object__find_program_by_name(baseline_object, "baseline");
+    if (!program) {
+        throw std::runtime_error("Failed to find baseline program baseline");
+    }
+
+    std::vector<std::optional<int>> assignments(cpu_program_assignments.size());
+    for (size_t cpu = 0; cpu < assignments.size(); cpu++) {
+        if (cpu_program_assignments[cpu].has_value()) {
+            assignments[cpu] = parameters.backend->program_handle(program);
+        }
+    }
+
+    std::vector<double> baseline_durations(assignments.size());
+    for (int trial = 0; trial < trials; trial++) {
+        auto opts = run_test_programs(assignments, parameters).opts;
+        for (size_t cpu = 0; cpu < assignments.size(); cpu++) {
+            baseline_durations[cpu] += static_cast<double>(opts[cpu].duration) / trials;
+        }
+    }
+    return baseline_durations;
+}
+
+// Measure how much cheaper fetching a key from the key table (table_key program) is than generating it with
+// bpf_get_prandom_u32 (random_key program), on the CPUs the test runs on. This is the overhead that tests using the key
+// table no longer include in their duration. A <name>_key_table program that replaces more than the generation of a
+// single key, such as the LPM read program that also derives the host part of the address from the key, is measured
+// with the random_key_<name> and table_key_<name> programs of the object instead.
+double
+measure_key_generation_overhead(
+    bpf_object* obj,
+    const YAML::Node& program_cpu_assignment,
+    const std::vector<std::optional<int>>& cpu_program_assignments,
+    const test_run_parameters& parameters)
+{
+    static const std::string key_table_suffix = "_key_table";
+    const std::string key_program_names[2] = {"random_key", "table_key"};
+
+    // Handles of the random and table key programs of each program of the test.
+    std::map<int, std::array<int, 2>> key_programs;
+    for (auto assignment : program_cpu_assignment) {
+        auto program_name = assignment.first.as<std::string>();
+        auto program = bpf_object__find_program_by_name(obj, program_name.c_str());
+        if (!program) {
+            throw std::runtime_error("Failed to find program " + program_name);
+        }
+        std::array<int, 2> handles;
+        for (int i = 0; i < 2; i++) {
+            bpf_program* key_program = nullptr;
+            if (program_name.ends_with(key_table_suffix)) {
+                auto specific_name = key_program_names[i] + "_" +
+                                     program_name.substr(0, program_name.size() - key_table_suffix.size());
+                key_program = bpf_object__find_program_by_name(obj, specific_name.c_str());
+            }
+            if (!key_program) {
+                key_program = bpf_object__find_program_by_name(obj, key_program_names[i].c_str());
+            }
+            if (!key_program) {
+                throw std::runtime_error("Failed to find program " + key_program_names[i]);
+            }
+            handles[i] = parameters.backend->program_handle(key_program);
+        }
+        key_programs[parameters.backend->program_handle(program)] = handles;
+    }
+
+    double mean_durations[2] = {};
+    for (int i = 0; i < 2; i++) {
+        std::vector<std::optional<int>> assignments(cpu_program_assignments.size());
+        size_t assigned_cpus = 0;
+        for (size_t cpu = 0; cpu < assignments.size(); cpu++) {
+            if (cpu_program_assignments[cpu].has_value()) {
+                assignments[cpu] = key_programs.at(*cpu_program_assignments[cpu])[i];
+                assigned_cpus++;
+            }
+        }
+
+        auto opts = run_test_programs(assignments, parameters).opts;
+        for (size_t cpu = 0; cpu < assignments.size(); cpu++) {
+            if (assignments[cpu].has_value()) {
+                mean_durations[i] += static_cast<double>(opts[cpu].duration) / assigned_cpus;
+            }
+        }
+    }
+    return mean_durations[0] - mean_durations[1];
+}
+
+// Measure the cost of the bpf_ktime_get_ns call that a latency histogram adds to each measured latency, by running the
+// test_bpf_ktime_get_ns program of the helpers tests on the CPUs the test runs on. The harness overhead is subtracted
+// when the baseline was measured.
+double
+measure_timer_overhead(
+    bpf_object* timer_object,
+    const std::vector<std::optional<int>>& cpu_program_assignments,
+    const test_run_parameters& parameters,
+    const std::vector<double>& baseline_durations)
+{
+    auto program = bpf_object__find_program_by_name(timer_object, "test_bpf_ktime_get_ns");
+    if (!program) {
+        throw std::runtime_error("Failed to find program test_bpf_ktime_get_ns");
+    }
+
+    std::vector<std::optional<int>> assignments(cpu_program_assignments.size());
+    size_t assigned_cpus = 0;
+    for (size_t cpu = 0; cpu < assignments.size(); cpu++) {
+        if (cpu_program_assignments[cpu].has_value()) {
+            assignments[cpu] = parameters.backend->program_handle(program);
+            assigned_cpus++;
+        }
+    }
+
+    double timer_overhead = 0;
+    auto opts = run_test_programs(assignments, parameters).opts;
+    for (size_t cpu = 0; cpu < assignments.size(); cpu++) {
+        if (assignments[cpu].has_value()) {
+            double duration = static_cast<double>(opts[cpu].duration);
+            if (!baseline_durations.empty()) {
+                duration -= baseline_durations[cpu];
+            }
+            timer_overhead += duration / assigned_cpus;
+        }
+    }
+    return std::max(timer_overhead, 0.0);
+}
+
+// Parse a duration such as "2s", "500ms", "250us" or "100ns". A value without a unit is in seconds.
+std::chrono::nanoseconds
+parse_duration(const std::string& value)
+{
+    std::smatch match;
+    if (!std::regex_match(value, match, std::regex("^([0-9]*\\.?[0-9]+)(ns|us|ms|s)?$"))) {
+        throw std::runtime_error("Invalid duration " + value);
+    }
+    double amount = std::stod(match[1].str());
+    std::string unit = match[2].matched ? match[2].str() : "s";
+    double multiplier = 1e9;
+    if (unit == "ns") {
+        multiplier = 1;
+    } else if (unit == "us") {
+        multiplier = 1e3;
+    } else if (unit == "ms") {
+        multiplier = 1e6;
+    }
+    return std::chrono::nanoseconds(static_cast<int64_t>(amount * multiplier));
+}
+
+// Pick an iteration count so that a run of the test takes approximately target_time on the slowest CPU.
+// The test is first run with increasing iteration counts until a run lasts long enough to give a stable
+// estimate of the per iteration cost. These runs double as the warmup (JIT, caches, branch predictors)
+// and their results are discarded.
+int
+calibrate_iteration_count(
+    const std::vector<std::optional<int>>& cpu_program_assignments,
+    test_run_parameters parameters,
+    std::chrono::nanoseconds target_time)
+{
+    const double minimum_calibration_time_ns = std::min(1e8, target_time.count() / 10.0);
+    const int maximum_iteration_count = std::numeric_limits<int>::max();
+    double duration_per_iteration = 0;
+
+    parameters.repeat = 1000;
+    for (;;) {
+        auto opts = run_test_programs(cpu_program_assignments, parameters).opts;
+        duration_per_iteration = 0;
+        for (auto& opt : opts) {
+            duration_per_iteration = std::max(duration_per_iteration, static_cast<double>(opt.duration));
+        }
+        // Sub-nanosecond programs report a duration of 0.
+        duration_per_iteration = std::max(duration_per_iteration, 1.0);
+
+        if (duration_per_iteration * parameters.repeat >= minimum_calibration_time_ns ||
+            parameters.repeat > maximum_iteration_count / 10) {
+            break;
+        }
+        parameters.repeat *= 10;
+    }
+
+    double iteration_count = target_time.count() / duration_per_iteration;
+    return static_cast<int>(std::clamp(iteration_count, 1.0, static_cast<double>(maximum_iteration_count)));
+}
+
+// Replace each ${variable} in value with its value from the matrix variables.
+std::string
+substitute_matrix_variables(
+    const std::string& value, const std::map<std::string, std::string>& variables, const std::string& test_name)
+{
+    static const std::regex variable_pattern("\\$\\{([A-Za-z0-9_.]+)\\}");
+    std::string result;
+    auto last = value.cbegin();
+    for (std::sregex_iterator it(value.begin(), value.end(), variable_pattern), end; it != end; ++it) {
+        auto variable = variables.find((*it)[1].str());
+        if (variable == variables.end()) {
+            throw std::runtime_error("Unknown matrix variable " + (*it)[1].str() + " in test " + test_name);
+        }
+        result.append(last, value.cbegin() + it->position());
+        result += variable->second;
+        last = value.cbegin() + it->position() + it->length();
+    }
+    result.append(last, value.cend());
+    return result;
+}
+
+// Return a copy of node with the matrix variables substituted in all scalars, including map keys.
+YAML::Node
+substitute_matrix_variables(
+    const YAML::Node& node, const std::map<std::string, std::string>& variables, const std::string& test_name)
+{
+    switch (node.Type()) {
+    case YAML::NodeType::Scalar:
+        return YAML::Node(substitute_matrix_variables(node.Scalar(), variables, test_name));
+    case YAML::NodeType::Sequence: {
+        YAML::Node result(YAML::NodeType::Sequence);
+        for (auto element : node) {
+            result.push_back(substitute_matrix_variables(element, variables, test_name));
+        }
+        return result;
+    }
+    case YAML::NodeType::Map: {
+        YAML::Node result(YAML::NodeType::Map);
+        for (auto element : node) {
+            result[substitute_matrix_variables(element.first.Scalar(), variables, test_name)] =
+                substitute_matrix_variables(element.second, variables, test_name);
+        }
+        return result;
+    }
+    default:
+        return YAML::Clone(node);
+    }
+}
+
+// Expand tests that have a matrix field into one test per combination of the matrix values.
+// The matrix maps a variable name to a list of values, which are referenced as ${variable} anywhere in the test.
+// A value can itself be a map of related values, referenced as ${variable.key}.
+std::vector<YAML::Node>
+expand_test_matrix(const YAML::Node& tests)
+{
+    std::vector<YAML::Node> expanded_tests;
+    for (auto test : tests) {
+        auto matrix = test["matrix"];
+        if (!matrix) {
+            expanded_tests.push_back(test);
+            continue;
+        }
+
+        std::string name = test["name"].IsDefined() ? test["name"].as<std::string>() : "";
+        if (!matrix.IsMap() || matrix.size() == 0) {
+            throw std::runtime_error("Field matrix must be a map of variables to lists of values in test " + name);
+        }
+
+        // Each combination binds one value of every variable.
+        std::vector<std::map<std::string, std::string>> combinations = {{}};
+        for (auto variable : matrix) {
+            auto variable_name = variable.first.as<std::string>();
+            if (!variable.second.IsSequence() || variable.second.size() == 0) {
+                throw std::runtime_error(
+                    "Field matrix." + variable_name + " must be a non-empty sequence in test " + name);
+            }
+
+            std::vector<std::map<std::string, std::string>> next_combinations;
+            for (const auto& combination : combinations) {
+                for (auto value : variable.second) {
+                    auto next_combination = combination;
+                    if (value.IsMap()) {
+                        for (auto field : value) {
+                            next_combination[variable_name + "." + field.first.as<std::string>()] =
+                                field.second.as<std::string>();
+                        }
+                    } else {
+                        next_combination[variable_name] = value.as<std::string>();
+                    }
+                    next_combinations.push_back(next_combination);
+                }
+            }
+            combinations = std::move(next_combinations);
+        }
+
+        YAML::Node test_template = YAML::Clone(test);
+        test_template.remove("matrix");
+        for (const auto& combination : combinations) {
+            auto expanded_test = substitute_matrix_variables(test_template, combination, name);
+            if (combinations.size() > 1 && expanded_test["name"].IsDefined() &&
+                expanded_test["name"].as<std::string>() == name) {
+                throw std::runtime_error("Field name must reference a matrix variable in test " + name);
+            }
+            expanded_tests.push_back(expanded_test);
+        }
+    }
+    return expanded_tests;
+}
+
 // This program runs a set of BPF programs and reports the average execution time for each program.
 // It reads a YAML file that contains the following fields:
 // - tests: a list of tests to run
 //   - name: the name of the test
 //   - elf_file: the path to the BPF object file
 //   - iteration_count: the number of times to run each program
-//   - map_state_preparation: optional, a program to run before the test to prepare the map state
-//     - program: the name of the program
+//   - matrix: optional, a map of variable names to lists of values. The test is expanded into one test per
+//     combination of values, with ${variable} replaced by the value anywhere in the test (including program names).
+//     A value can be a map of related values, referenced as ${variable.key}.
+//   - maps: optional, a map of map names to overrides applied before the BPF object is loaded
+//     - max_entries, map_flags, key_size, value_size, numa_node: optional, the new value. map_flags is a number or
+//       a list of flag names separated by "|", such as BPF_F_NO_PREALLOC.
+//   - globals: optional, a map of global variable names (such as "volatile const" values) to integer values set
+//     before the BPF object is loaded
+//   - key_distribution: optional, the distribution of the keys that programs take from the key table, which is sized
+//     to key_count when the object is loaded (Linux only)
+//     - type: optional, uniform (default), zipf, hot_set or sequential
+//     - key_count: optional, the number of keys present in the map (default max_entries of the map)
+//     - map: optional, the map used for the default key_count (default "map")
+//     - theta: optional, the exponent of the zipf distribution (default 0.99)
+//     - hot_set, hot_access: optional, the fraction of keys that are hot and the fraction of accesses to them
+//       (default 0.2 and 0.8)
+//     - stride: optional, the distance between consecutive sequential keys (default 1)
+//     - miss_ratio: optional, the fraction of accesses to keys that aren't in the map (default 0)
+//     - seed: optional, the seed of the random number generator
+//   - operation_mix: optional, a map of operations (lookup, update and delete) to their weights, such as
+//     {lookup: 95, update: 4, delete: 1}, interleaved by the mixed programs on every CPU. The keys are taken from the
+//     key table, which defaults to a uniform key_distribution.
+//   - background_workload: optional, a list of userspace workloads that modify the maps of the test while it runs.
+//     The test is also run without them to report the slowdown they cause.
+//     - map: the name of the map to modify
+//     - operation: optional, update (default), delete, replace (delete then update) or update_batch
+//     - key_count: optional, the number of keys cycled through (default max_entries of the map)
+//     - batch_size: optional, the number of keys per update_batch operation (default 64)
+//     - rate: optional, the target number of element operations per second (default as fast as possible)
+//     - threads: optional, the number of userspace threads applying the workload (default 1)
+//   - userspace: optional, makes the test issue map operations from userspace instead of running programs, in which
+//     case iteration_count is the number of elements operated on. The programs of program_cpu_assignment, if any,
+//     run concurrently on the other CPUs.
+//     - map: the name of the map to operate on
+//     - operation: optional, lookup (default), update, delete, get_next_key, iterate, lookup_batch, update_batch,
+//       delete_batch, mmap_read or mmap_write
+//     - key_count: optional, the number of keys cycled through (default max_entries of the map)
+//     - batch_size: optional, the number of elements per batch operation (default 256)
+//     - cpu: optional, the CPU to run on (default 0)
+//   - ring_buffer_consumer: optional, a userspace consumer that drains a ring buffer or perf event array while the
+//     programs produce into it (Linux only)
+//     - map: the name of the BPF_MAP_TYPE_RINGBUF or BPF_MAP_TYPE_PERF_EVENT_ARRAY map
+//     - mode: optional, epoll (default) to wait for records or busy_poll to spin consuming them
+//     - pages: optional, the number of pages of the buffer of each CPU of a perf event array (default 64)
+//     - cpu: optional, the CPU to pin the consumer to, which programs assigned to it are skipped on
+//     - latency: optional, true if records start with the bpf_ktime_get_ns time they were produced at
+//   - latency_histogram: optional, percentiles of the latency of each program invocation, from the histogram that
+//     programs built with LATENCY_HISTOGRAM record into
+//     - map: optional, the name of the histogram map (default latency_histogram_map)
+//     - timer_calibration: optional, the helpers object whose test_bpf_ktime_get_ns program measures the cost of
+//       bpf_ktime_get_ns, which is subtracted from the latencies
+//   - user_ring_buffer_producer: optional, a userspace producer that fills a user ring buffer while the programs drain
+//     it (Linux only)
+//     - map: the name of the BPF_MAP_TYPE_USER_RINGBUF map
+//     - record_size: optional, the size of each record (default 128)
+//     - cpu: optional, the CPU to pin the producer to, which programs assigned to it are skipped on
+//     - drained_count_map: optional, a per CPU array whose first value the programs add the records they drain to
+//   - trials: optional, the number of times to repeat the test to gather summary statistics (default 1)
+//   - map_state_preparation: optional, how to prepare the map state before the test. Each test starts from the
+//     state of the maps after the object was loaded followed by its preparation, which is restored from a snapshot
+//     when the object and preparation were already used by a previous test.
+//     - maps: optional, a list of maps to fill from userspace before running the program
+//       - name: the name of the map
+//       - generator: optional, sequential (default), random or file
+//       - count: optional, the number of entries (default max_entries, or the whole file)
+//       - file: the path of a file with one hex encoded key and value per line, for the file generator
+//       - seed: optional, the seed of the random generator
+//     - program: the name of the program, optional if maps is specified
 //     - iteration_count: the number of times to run the program
 //   - program_cpu_assignment: a map of program names to CPUs
 //     - <program name>: the name of the program
 //       - <cpu number>: the CPU number to run the program on
 //       - all: run the program on all CPUs
 //       - remaining: run the program on all remaining CPUs
+//       - any: run the program on the first CPU without a program that doesn't run the ring_buffer_consumer or
+//         user_ring_buffer_producer of the test, or skip the test if there is none
+//   When sweeping the CPU count, "all" and "remaining" only cover the CPUs in use and listed CPUs beyond them are
+//   skipped.
 int
 main(int argc, char** argv)
 {
@@ -106,7 +1396,17 @@ main(int argc, char** argv)
         std::optional<bool> ignore_return_code;
         std::optional<std::string> pre_test_command;
         std::optional<std::string> post_test_command;
+        std::optional<int> trials_override;
+        std::optional<std::chrono::nanoseconds> target_time;
+        std::optional<std::string> baseline_elf_file;
+        bool sweep = false;
+        bool count_hardware_events = false;
+        bool report_run_time_statistics = false;
+        bool report_load_statistics = false;
+        std::string backend_name = "kernel";
         bool csv_header_printed = false;
+        // Load statistics of the objects loaded by the current test, printed after its row.
+        std::vector<object_load_statistics> load_statistics;
 
         // Add option "-i" for test input file.
         cmd_options.add(
@@ -162,6 +1462,62 @@ main(int argc, char** argv)
             [&post_test_command](auto iter) { post_test_command = *iter; },
             "Command to run after each test");
 
+        // Add option to repeat each test for a number of trials.
+        cmd_options.add(
+            "--trials",
+            2,
+            [&trials_override](auto iter) { trials_override = std::stoi(*iter); },
+            "Number of trials to run each test for (overrides the trials field)");
+
+        // Add option to calibrate the iteration count of each test to a target duration.
+        cmd_options.add(
+            "--target-time",
+            2,
+            [&target_time](auto iter) { target_time = parse_duration(*iter); },
+            "Warm up and calibrate the iteration count so each test runs for this long (e.g. 2s, 500ms)");
+
+        // Add option to subtract the harness overhead measured with the baseline program.
+        cmd_options.add(
+            "--baseline",
+            2,
+            [&baseline_elf_file](auto iter) { baseline_elf_file = *iter; },
+            "BPF object containing the baseline program, used to report the net cost of each test");
+
+        // Add option to sweep the number of CPUs each test runs on.
+        cmd_options.add(
+            "--sweep",
+            1,
+            [&sweep](auto iter) { sweep = true; },
+            "Run each test on 1, 2, 4, ... CPUs up to the CPU count and report the scaling efficiency");
+
+        // Add option to count hardware events with perf_event_open around each program run.
+        cmd_options.add(
+            "--hardware-counters",
+            1,
+            [&count_hardware_events](auto iter) { count_hardware_events = true; },
+            "Count cycles, instructions, cache, TLB and branch misses on each CPU (Linux only)");
+
+        // Add option to report the run time statistics that the kernel keeps with BPF_ENABLE_STATS.
+        cmd_options.add(
+            "--run-time-stats",
+            1,
+            [&report_run_time_statistics](auto iter) { report_run_time_statistics = true; },
+            "Enable BPF_STATS_RUN_TIME and report the run_time_ns and run_cnt of the programs (Linux only)");
+
+        // Add option to report the cost of opening, verifying and loading the BPF objects.
+        cmd_options.add(
+            "--load-stats",
+            1,
+            [&report_load_statistics](auto iter) { report_load_statistics = true; },
+            "Report the open and load time of each BPF object and the verifier statistics and size of its programs");
+
+        // Add option to select the backend that runs the programs.
+        cmd_options.add(
+            "--backend",
+            2,
+            [&backend_name](auto iter) { backend_name = *iter; },
+            "Run the programs in the kernel (default), or in the uBPF interpreter (ubpf) or JIT compiler (ubpf-jit)");
+
         // Parse command line options.
         cmd_options.parse(argc, argv);
 
@@ -169,20 +1525,114 @@ main(int argc, char** argv)
             throw std::runtime_error("Test input file is required");
         }
 
+        auto backend = create_execution_backend(backend_name);
+        if (!backend->runs_in_kernel() && report_run_time_statistics) {
+            throw std::runtime_error("Run time statistics are not supported by the " + backend->name() + " backend");
+        }
+
+#if defined(__linux__)
+        // The kernel keeps the run time statistics of programs for as long as this fd is open, which is the lifetime of
+        // the runner.
+        if (report_run_time_statistics && bpf_enable_stats(BPF_STATS_RUN_TIME) < 0) {
+            throw std::runtime_error("Failed to enable BPF_STATS_RUN_TIME: " + std::string(strerror(errno)));
+        }
+#else
+        if (count_hardware_events) {
+            throw std::runtime_error("Hardware counters are only supported on Linux");
+        }
+        if (report_run_time_statistics) {
+            throw std::runtime_error("Run time statistics are only supported on Linux");
+        }
+#endif
+
+        if (target_time.has_value() && iteration_count_override.has_value()) {
+            throw std::runtime_error("Options -c and --target-time are mutually exclusive");
+        }
+
         YAML::Node config = YAML::LoadFile(test_file);
-        auto tests = config["tests"];
+        auto tests_node = config["tests"];
         std::map<std::string, bpf_object_ptr> bpf_objects;
+        // Map state of each BPF object after it was loaded, and after each map state preparation it was used with.
+        std::map<bpf_object*, map_state_snapshot> loaded_map_states;
+        std::map<std::pair<bpf_object*, std::string>, prepared_map_state> prepared_map_states;
+        // Baseline duration per CPU for each invocation shape.
+        std::map<std::string, std::vector<double>> baseline_durations_by_shape;
 
         // Query libbpf for cpu count if not specified on command line.
         int cpu_count = cpu_count_override.value_or(libbpf_num_possible_cpus());
 
         // Fail if tests is empty or not a sequence.
-        if (!tests || !tests.IsSequence()) {
+        if (!tests_node || !tests_node.IsSequence()) {
             throw std::runtime_error("Invalid config file - tests must be a sequence");
         }
 
-        // Run each test.
+        auto tests = expand_test_matrix(tests_node);
+
+        // Windows uses .sys instead of .o for eBPF files that are compiled into a driver.
+        auto object_file_name = [&](const std::string& file) {
+            if (!ebpf_file_extension_override.has_value()) {
+                return file;
+            }
+            return file.substr(0, file.find_last_of('.')) + ebpf_file_extension_override.value();
+        };
+
+        // Index of the last test that loads each object with map or global overrides, or with a key table sized to
+        // its keys. Such objects can hold maps with millions of entries, so they are closed, and their map state
+        // snapshots dropped, after that test.
+        std::map<std::string, size_t> last_override_uses;
+        for (size_t i = 0; i < tests.size(); i++) {
+            auto test = tests[i];
+            auto key_distribution = key_table_distribution(test);
+            if (test["elf_file"].IsDefined() &&
+                (test["maps"].IsDefined() || test["globals"].IsDefined() || key_distribution)) {
+                last_override_uses[bpf_object_key(
+                    object_file_name(test["elf_file"].as<std::string>()),
+                    test["maps"],
+                    test["globals"],
+                    key_distribution)] = i;
+            }
+        }
+
+        // Summary statistics columns are only reported if any test is run for more than one trial.
+        bool report_trial_statistics = trials_override.has_value();
+        // Map state preparation time is only reported if any test prepares the map state.
+        bool report_map_state_preparation = false;
+        // The overhead removed by the key table is only reported if any test uses it.
+        bool report_key_generation_overhead = false;
+        // The effect of background workloads is only reported if any test has one.
+        bool report_background_workload = false;
+        // Ring buffer consumption is only reported if any test has a consumer.
+        bool report_ring_buffer_consumer = false;
+        // User ring buffer production is only reported if any test has a producer.
+        bool report_user_ring_buffer_producer = false;
+        // Latency percentiles are only reported if any test has a latency histogram.
+        bool report_latency_histogram = false;
         for (auto test : tests) {
+            if (test["trials"].IsDefined()) {
+                report_trial_statistics = true;
+            }
+            if (test["map_state_preparation"].IsDefined()) {
+                report_map_state_preparation = true;
+            }
+            if (test["key_distribution"].IsDefined()) {
+                report_key_generation_overhead = true;
+            }
+            if (test["background_workload"].IsDefined()) {
+                report_background_workload = true;
+            }
+            if (test["ring_buffer_consumer"].IsDefined()) {
+                report_ring_buffer_consumer = true;
+            }
+            if (test["user_ring_buffer_producer"].IsDefined()) {
+                report_user_ring_buffer_producer = true;
+            }
+            if (test["latency_histogram"].IsDefined()) {
+                report_latency_histogram = true;
+            }
+        }
+
+        // Run a single test, returning early if it doesn't apply to this run.
+        auto run_test_case = [&](YAML::Node test) {
             // Check for required fields.
             if (!test["name"].IsDefined()) {
                 throw std::runtime_error("Field name is required");
@@ -196,11 +1646,12 @@ main(int argc, char** argv)
                 throw std::runtime_error("Field iteration_count is required");
             }
 
-            if (!test["program_cpu_assignment"].IsDefined()) {
+            // Userspace tests issue map operations from the runner instead of running programs.
+            if (!test["program_cpu_assignment"].IsDefined() && !test["userspace"].IsDefined()) {
                 throw std::runtime_error("Field program_cpu_assignment is required");
             }
 
-            if (!test["program_cpu_assignment"].IsMap()) {
+            if (test["program_cpu_assignment"].IsDefined() && !test["program_cpu_assignment"].IsMap()) {
                 throw std::runtime_error("Field program_cpu_assignment must be a map");
             }
 
@@ -213,13 +1664,14 @@ main(int argc, char** argv)
             bool pass_data = DEFAULT_PASS_DATA;
             bool pass_context = DEFAULT_PASS_CONTEXT;
             uint32_t expected_result = 0;
+            int trials = 1;
 
             // Check if value "platform" is defined and matches the current platform.
             if (test["platform"].IsDefined()) {
                 std::string platform = test["platform"].as<std::string>();
                 if (runner_platform != platform) {
                     // Don't run this test if the platform doesn't match.
-                    continue;
+                    return;
                 }
             }
 
@@ -250,6 +1702,20 @@ main(int argc, char** argv)
                 expected_result = test["expected_result"].as<uint32_t>();
             }
 
+            // Check if trials is defined and use it.
+            if (test["trials"].IsDefined()) {
+                trials = test["trials"].as<int>();
+            }
+
+            // Override trials if specified on command line.
+            if (trials_override.has_value()) {
+                trials = trials_override.value();
+            }
+
+            if (trials < 1) {
+                throw std::runtime_error("Field trials must be greater than zero");
+            }
+
             // Override batch size if specified on command line.
             if (batch_size_override.has_value()) {
                 batch_size = batch_size_override.value();
@@ -257,287 +1723,866 @@ main(int argc, char** argv)
 
             // Skip if test name is specified and doesn't match, with test name being a regex.
             if (test_name && !std::regex_match(name, std::regex(*test_name))) {
-                continue;
+                return;
             }
 
             // If eBPF file extension override is specified, use it.
-            // Windows uses .sys instead of .o for eBPF files that are compiled into a driver.
-            if (ebpf_file_extension_override.has_value()) {
-                elf_file = elf_file.substr(0, elf_file.find_last_of('.')) + ebpf_file_extension_override.value();
+            elf_file = object_file_name(elf_file);
+
+            if (test["maps"].IsDefined() && !test["maps"].IsMap()) {
+                throw std::runtime_error("Field maps must be a map");
             }
 
-            if (bpf_objects.find(elf_file) == bpf_objects.end()) {
-                bpf_object_ptr obj;
+            if (test["globals"].IsDefined() && !test["globals"].IsMap()) {
+                throw std::runtime_error("Field globals must be a map");
+            }
 
-                obj.reset(bpf_object__open(elf_file.c_str()));
-                if (!obj) {
-                    throw std::runtime_error("Failed to open BPF object " + elf_file + ": " + strerror(errno) + "/" + std::to_string(errno));
+            // These access the programs and maps of the test as kernel objects rather than through the backend.
+            if (!backend->runs_in_kernel()) {
+                for (auto field :
+                     {"globals",
+                      "userspace",
+                      "background_workload",
+                      "ring_buffer_consumer",
+                      "user_ring_buffer_producer",
+                      "latency_histogram"}) {
+                    if (test[field].IsDefined()) {
+                        throw unsupported_by_backend_error(
+                            "Field " + std::string(field) + " is not supported by the " + backend->name() + " backend");
+                    }
                 }
+            }
 
-                bpf_program* program;
-                bpf_object__for_each_program(program, obj.get())
-                {
-                    bpf_prog_type prog_type;
-                    bpf_attach_type attach_type;
-                    if (program_type.has_value()) {
-                        // If program_type is specified, use it.
-                        if (libbpf_prog_type_by_name(program_type->c_str(), &prog_type, &attach_type) < 0) {
-                            throw std::runtime_error("Failed to get program type " + *program_type);
-                        }
-                    } else {
-                        // If program_type is not specified, use DEFAULT_PROG_TYPE.
-                        prog_type = DEFAULT_PROG_TYPE;
-                        attach_type = DEFAULT_ATTACH_TYPE;
+            auto key_distribution = key_table_distribution(test);
+            size_t loaded_object_count = load_statistics.size();
+            bpf_object* obj = load_bpf_object(
+                *backend,
+                bpf_objects,
+                elf_file,
+                program_type,
+                test["maps"],
+                test["globals"],
+                key_distribution,
+                report_load_statistics ? &load_statistics : nullptr);
+            bool loaded_object = load_statistics.size() > loaded_object_count;
+            if (loaded_object && (test["maps"].IsDefined() || test["globals"].IsDefined() || key_distribution)) {
+                // The same ELF file is loaded once per set of overrides and key table, which the test name tells apart.
+                load_statistics.back().object_name += " (" + name + ")";
+            }
+
+            // Userspace threads that modify the maps while the test runs, as a control plane would.
+            std::optional<background_workload> background;
+            if (test["background_workload"].IsDefined()) {
+                background.emplace(obj, parse_background_workload(test["background_workload"]));
+            }
+
+            // Userspace consumer of the records the programs produce into a ring buffer.
+            std::optional<ring_buffer_consumer> consumer;
+            std::optional<int> consumer_cpu;
+            if (test["ring_buffer_consumer"].IsDefined()) {
+                auto consumer_node = test["ring_buffer_consumer"];
+                if (!consumer_node.IsMap() || !consumer_node["map"].IsDefined()) {
+                    throw std::runtime_error("Field ring_buffer_consumer.map is required");
+                }
+                ring_buffer_consumer_parameters consumer_parameters;
+                consumer_parameters.map_name = consumer_node["map"].as<std::string>();
+                if (consumer_node["mode"].IsDefined()) {
+                    consumer_parameters.mode = consumer_node["mode"].as<std::string>();
+                }
+                if (consumer_node["pages"].IsDefined()) {
+                    consumer_parameters.perf_buffer_pages = consumer_node["pages"].as<size_t>();
+                }
+                if (consumer_node["cpu"].IsDefined()) {
+                    consumer_cpu = consumer_node["cpu"].as<int>();
+                    if (*consumer_cpu < 0 || *consumer_cpu >= cpu_count) {
+                        throw std::runtime_error("Invalid CPU number " + std::to_string(*consumer_cpu));
                     }
-                    (void)bpf_program__set_type(program, prog_type);
+                    consumer_parameters.cpu = consumer_cpu;
                 }
-
-                if (bpf_object__load(obj.get()) < 0) {
-                    throw std::runtime_error("Failed to load BPF object " + elf_file + ": " + strerror(errno) + "/" + std::to_string(errno));
+                if (consumer_node["latency"].IsDefined()) {
+                    consumer_parameters.latency = consumer_node["latency"].as<bool>();
                 }
+                consumer.emplace(obj, consumer_parameters);
+            }
 
-                // Insert into bpf_objects
-                bpf_objects.insert({elf_file, std::move(obj)});
+            // Userspace producer that fills a user ring buffer while the test runs, and the CPU it is pinned to.
+            std::optional<user_ring_buffer_producer> producer;
+            std::optional<int> producer_cpu;
+            if (test["user_ring_buffer_producer"].IsDefined()) {
+                auto producer_node = test["user_ring_buffer_producer"];
+                if (!producer_node.IsMap() || !producer_node["map"].IsDefined()) {
+                    throw std::runtime_error("Field user_ring_buffer_producer.map is required");
+                }
+                user_ring_buffer_producer_parameters producer_parameters;
+                producer_parameters.map_name = producer_node["map"].as<std::string>();
+                if (producer_node["record_size"].IsDefined()) {
+                    producer_parameters.record_size = producer_node["record_size"].as<uint32_t>();
+                }
+                if (producer_node["cpu"].IsDefined()) {
+                    producer_cpu = producer_node["cpu"].as<int>();
+                    if (*producer_cpu < 0 || *producer_cpu >= cpu_count) {
+                        throw std::runtime_error("Invalid CPU number " + std::to_string(*producer_cpu));
+                    }
+                    producer_parameters.cpu = producer_cpu;
+                }
+                if (producer_node["drained_count_map"].IsDefined()) {
+                    producer_parameters.drained_count_map_name = producer_node["drained_count_map"].as<std::string>();
+                }
+                producer.emplace(obj, producer_parameters);
             }
 
-            // Vector of CPU -> program fd.
-            std::vector<std::optional<int>> cpu_program_assignments(cpu_count);
+            // Histogram of the latency of each program invocation, and the object that calibrates the timer with.
+            std::optional<std::string> latency_histogram_map;
+            bpf_object* timer_object = nullptr;
+            if (test["latency_histogram"].IsDefined()) {
+                auto histogram_node = test["latency_histogram"];
+                if (!histogram_node.IsMap()) {
+                    throw std::runtime_error("Field latency_histogram must be a map");
+                }
+                latency_histogram_map = histogram_node["map"].IsDefined() ? histogram_node["map"].as<std::string>()
+                                                                          : "latency_histogram_map";
+                (void)read_latency_histogram(obj, *latency_histogram_map);
+                if (histogram_node["timer_calibration"].IsDefined()) {
+                    std::string timer_file = object_file_name(histogram_node["timer_calibration"].as<std::string>());
+                    timer_object = load_bpf_object(*backend, bpf_objects, timer_file, program_type);
+                }
+            }
 
-            bpf_object_ptr& obj = bpf_objects[elf_file];
+            // Map operation issued from userspace by a userspace test, and the CPU it runs on.
+            std::optional<userspace_benchmark_parameters> userspace;
+            int userspace_cpu = 0;
+            if (test["userspace"].IsDefined()) {
+                auto userspace_node = test["userspace"];
+                if (!userspace_node.IsMap() || !userspace_node["map"].IsDefined()) {
+                    throw std::runtime_error("Field userspace.map is required");
+                }
+                userspace.emplace();
+                userspace->map_name = userspace_node["map"].as<std::string>();
+                if (userspace_node["operation"].IsDefined()) {
+                    userspace->operation = userspace_node["operation"].as<std::string>();
+                }
+                if (userspace_node["key_count"].IsDefined()) {
+                    userspace->key_count = userspace_node["key_count"].as<uint32_t>();
+                }
+                if (userspace_node["batch_size"].IsDefined()) {
+                    userspace->batch_size = userspace_node["batch_size"].as<uint32_t>();
+                }
+                if (userspace_node["cpu"].IsDefined()) {
+                    userspace_cpu = userspace_node["cpu"].as<int>();
+                }
+                if (userspace_cpu < 0 || userspace_cpu >= cpu_count) {
+                    throw std::runtime_error("Invalid CPU number " + std::to_string(userspace_cpu));
+                }
+            }
 
             // Check if node map_state_preparation exits.
             auto map_state_preparation = test["map_state_preparation"];
-            if (map_state_preparation) {
-                if (!map_state_preparation["program"].IsDefined()) {
-                    throw std::runtime_error("Field map_state_preparation.program is required");
+
+            // Every test starts from the same map state: the state of the object after it was loaded, followed by
+            // the map state preparation of the test. The state is prepared once per object and preparation, and a
+            // snapshot of it is restored for later tests rather than running the preparation again.
+            auto operation_mix = test["operation_mix"];
+            auto prepared_state_key = std::make_pair(
+                obj,
+                (map_state_preparation ? YAML::Dump(map_state_preparation) : std::string()) + "\n" +
+                    (key_distribution ? YAML::Dump(key_distribution) : std::string()) + "\n" +
+                    (operation_mix ? YAML::Dump(operation_mix) : std::string()));
+            auto prepared_state = prepared_map_states.find(prepared_state_key);
+            // True if the maps may have changed since the prepared state was captured or restored.
+            bool map_state_modified = true;
+            if (prepared_state == prepared_map_states.end()) {
+                auto loaded_state = loaded_map_states.find(obj);
+                if (loaded_state == loaded_map_states.end()) {
+                    loaded_map_states[obj] = backend->snapshot_map_state(obj);
+                } else {
+                    backend->restore_map_state(obj, loaded_state->second);
                 }
 
-                if (!map_state_preparation["iteration_count"].IsDefined()) {
-                    throw std::runtime_error("Field map_state_preparation.iteration_count is required");
+                // Wall-clock time spent preparing the map state, reported separately from the test.
+                auto map_state_preparation_start = std::chrono::steady_clock::now();
+
+                if (map_state_preparation && map_state_preparation["maps"].IsDefined()) {
+                    fill_maps(*backend, obj, map_state_preparation["maps"]);
+                }
+                if (key_distribution) {
+                    fill_key_table(*backend, obj, key_distribution);
                 }
+                if (operation_mix) {
+                    uint64_t seed = key_distribution && key_distribution["seed"].IsDefined()
+                                        ? key_distribution["seed"].as<uint64_t>()
+                                        : 0;
+                    fill_operation_table(*backend, obj, operation_mix, seed);
+                }
+                if (map_state_preparation && !map_state_preparation["program"].IsDefined() &&
+                    !map_state_preparation["maps"].IsDefined()) {
+                    throw std::runtime_error("Field map_state_preparation.program is required");
+                }
+                if (map_state_preparation && map_state_preparation["program"].IsDefined()) {
+                    if (!map_state_preparation["iteration_count"].IsDefined()) {
+                        throw std::runtime_error("Field map_state_preparation.iteration_count is required");
+                    }
+
+                    std::string prep_program_name = map_state_preparation["program"].as<std::string>();
+                    int prep_program_iterations = map_state_preparation["iteration_count"].as<int>();
+                    auto map_state_preparation_program =
+                        bpf_object__find_program_by_name(obj, prep_program_name.c_str());
+                    if (!map_state_preparation_program) {
+                        throw std::runtime_error("Failed to find map_state_preparation program " + prep_program_name);
+                    }
+
+                    // Run map_state_preparation program via the test run of the backend.
+                    std::vector<uint8_t> data_in(1024);
+                    std::vector<uint8_t> data_out(1024);
+
+                    bpf_test_run_opts opts;
+                    memset(&opts, 0, sizeof(opts));
+                    opts.sz = sizeof(opts);
+                    opts.repeat = prep_program_iterations;
+                    if (pass_data) {
+                        opts.data_in = data_in.data();
+                        opts.data_out = data_out.data();
+                        opts.data_size_in = static_cast<uint32_t>(data_in.size());
+                        opts.data_size_out = static_cast<uint32_t>(data_out.size());
+                    }
+                    if (pass_context) {
+                        opts.ctx_in = data_in.data();
+                        opts.ctx_out = data_out.data();
+                        opts.ctx_size_in = static_cast<uint32_t>(data_in.size());
+                        opts.ctx_size_out = static_cast<uint32_t>(data_out.size());
+                    }
+
+                    if (backend->test_run(backend->program_handle(map_state_preparation_program), &opts)) {
+                        throw std::runtime_error("Failed to run map_state_preparation program " + prep_program_name);
+                    }
 
-                std::string prep_program_name = map_state_preparation["program"].as<std::string>();
-                int prep_program_iterations = map_state_preparation["iteration_count"].as<int>();
-                auto map_state_preparation_program =
-                    bpf_object__find_program_by_name(obj.get(), prep_program_name.c_str());
-                if (!map_state_preparation_program) {
-                    throw std::runtime_error("Failed to find map_state_preparation program " + prep_program_name);
+                    if (opts.retval != expected_result) {
+                        std::string message = "map_state_preparation program " + prep_program_name +
+                                          " returned unexpected value " + std::to_string(opts.retval) + " expected " +
+                                          std::to_string(expected_result);
+                        if (ignore_return_code.value_or(false)) {
+                            std::cout << message << std::endl;
+                        } else {
+                            throw std::runtime_error(message);
+                        }
+                    }
                 }
+                std::chrono::duration<double, std::milli> map_state_preparation_duration =
+                    std::chrono::steady_clock::now() - map_state_preparation_start;
 
-                // Run map_state_preparation program via bpf_prog_test_run_opts.
-                std::vector<uint8_t> data_in(1024);
-                std::vector<uint8_t> data_out(1024);
+                prepared_map_state prepared = {
+                    backend->snapshot_map_state(obj), map_state_preparation_duration.count()};
+                prepared_state = prepared_map_states.insert({prepared_state_key, std::move(prepared)}).first;
+                map_state_modified = false;
+            }
+            double map_state_preparation_time = prepared_state->second.preparation_time;
+
+            // CPU counts to run the test on. A sweep runs it on 1, 2, 4, ... CPUs and finally on all CPUs.
+            std::vector<int> active_cpu_counts = {cpu_count};
+            if (sweep) {
+                active_cpu_counts.clear();
+                for (int count = 1; count < cpu_count; count *= 2) {
+                    active_cpu_counts.push_back(count);
+                }
+                active_cpu_counts.push_back(cpu_count);
+            }
 
-                bpf_test_run_opts opts;
-                memset(&opts, 0, sizeof(opts));
-                opts.sz = sizeof(opts);
-                opts.repeat = prep_program_iterations;
-                if (pass_data) {
-                    opts.data_in = data_in.data();
-                    opts.data_out = data_out.data();
-                    opts.data_size_in = static_cast<uint32_t>(data_in.size());
-                    opts.data_size_out = static_cast<uint32_t>(data_out.size());
+            // Aggregate throughput on a single CPU, used to compute the speedup of each sweep point.
+            double single_cpu_throughput = 0;
+
+            for (int active_cpu_count : active_cpu_counts) {
+                // Vector of CPU -> program fd. Userspace tests run on a single CPU without a program, while the
+                // programs assigned to the other CPUs, if any, run concurrently.
+                std::vector<std::optional<int>> cpu_program_assignments(cpu_count);
+                if (test["program_cpu_assignment"].IsDefined()) {
+                    std::set<int> reserved_cpus;
+                    for (auto cpu : {consumer_cpu, producer_cpu}) {
+                        if (cpu.has_value()) {
+                            reserved_cpus.insert(*cpu);
+                        }
+                    }
+                    cpu_program_assignments = assign_programs_to_cpus(
+                        *backend, obj, test["program_cpu_assignment"], cpu_count, active_cpu_count, reserved_cpus);
+                }
+                if (consumer_cpu.has_value()) {
+                    cpu_program_assignments[*consumer_cpu].reset();
                 }
-                if (pass_context) {
-                    opts.ctx_in = data_in.data();
-                    opts.ctx_out = data_out.data();
-                    opts.ctx_size_in = static_cast<uint32_t>(data_in.size());
-                    opts.ctx_size_out = static_cast<uint32_t>(data_out.size());
+                if (producer_cpu.has_value()) {
+                    cpu_program_assignments[*producer_cpu].reset();
                 }
+                std::vector<std::optional<int>> concurrent_programs;
+                if (userspace) {
+                    concurrent_programs = cpu_program_assignments;
+                    concurrent_programs[userspace_cpu].reset();
+                    cpu_program_assignments.assign(cpu_count, std::nullopt);
+                    cpu_program_assignments[userspace_cpu] = -1;
+                }
+
+                test_run_parameters parameters = {
+                    iteration_count_override.value_or(iteration_count),
+                    pass_data,
+                    pass_context,
+                    batch_size,
+                    count_hardware_events,
+                    backend.get()};
+
+                auto run_test = [&]() {
+                    if (userspace) {
+                        return run_userspace_test(
+                            obj,
+                            *userspace,
+                            userspace_cpu,
+                            cpu_count,
+                            parameters.repeat,
+                            concurrent_programs,
+                            parameters);
+                    }
+                    return run_test_programs(cpu_program_assignments, parameters);
+                };
 
-                if (bpf_prog_test_run_opts(bpf_program__fd(map_state_preparation_program), &opts)) {
-                    throw std::runtime_error("Failed to run map_state_preparation program " + prep_program_name);
+                // Warm up and pick the iteration count if calibration is requested.
+                if (target_time.has_value() && !userspace) {
+                    parameters.repeat = calibrate_iteration_count(cpu_program_assignments, parameters, *target_time);
+                    map_state_modified = true;
                 }
 
-                if (opts.retval != expected_result) {
-                    std::string message = "map_state_preparation program " + prep_program_name + " returned unexpected value " +
-                                          std::to_string(opts.retval) + " expected " + std::to_string(expected_result);
-                    if (ignore_return_code.value_or(false)) {
-                        std::cout << message << std::endl;
-                    } else {
-                        throw std::runtime_error(message);
+                // Measure the harness overhead for this invocation shape, unless already measured. The shape includes
+                // the iteration count, the number of trials and the CPUs the test runs on.
+                std::vector<double> baseline_durations;
+                if (baseline_elf_file.has_value() && !userspace) {
+                    std::string shape = program_type.value_or("") + "," + std::to_string(pass_data) + "," +
+                                        std::to_string(pass_context) + "," + std::to_string(batch_size) + "," +
+                                        std::to_string(parameters.repeat) + "," + std::to_string(trials) + ",";
+                    for (const auto& assignment : cpu_program_assignments) {
+                        shape += assignment.has_value() ? "1" : "0";
                     }
+                    if (baseline_durations_by_shape.find(shape) == baseline_durations_by_shape.end()) {
+                        bpf_object* baseline_object = load_bpf_object(
+                            *backend, bpf_objects, object_file_name(baseline_elf_file.value()), program_type);
+                        baseline_durations_by_shape[shape] =
+                            measure_baseline(baseline_object, cpu_program_assignments, parameters, trials);
+                    }
+                    baseline_durations = baseline_durations_by_shape[shape];
                 }
-            }
 
-            auto program_cpu_assignment = test["program_cpu_assignment"];
-            for (auto assignment : program_cpu_assignment) {
-                // Each node is a program name and a cpu number or a list of cpu numbers.
-                // First check if program exists and get program fd.
+                // Run the pre-test command if specified.
+                if (pre_test_command.has_value()) {
+                    std::string command = pre_test_command.value();
+                    std::string command_output;
+                    command = std::regex_replace(command, std::regex("%NAME%"), name);
+                    command = std::regex_replace(command, std::regex("%ELF_FILE%"), elf_file);
+                    command =
+                        std::regex_replace(command, std::regex("%ITERATION_COUNT%"), std::to_string(parameters.repeat));
+                    command = std::regex_replace(command, std::regex("%CPU_COUNT%"), std::to_string(active_cpu_count));
+                    command = std::regex_replace(command, std::regex("%BATCH_SIZE%"), std::to_string(batch_size));
+                    if (run_command_and_capture_output(command, command_output) != 0) {
+                        std::cerr << "Pre-test command failed: " << command << std::endl;
+                        std::cerr << command_output << std::endl;
+                    }
+                }
 
-                auto program_name = assignment.first.as<std::string>();
-                auto program = bpf_object__find_program_by_name(obj.get(), program_name.c_str());
-                if (!program) {
-                    throw std::runtime_error("Failed to find program " + program_name);
+                // Measure the cost of generating keys that the key table saves the test.
+                std::optional<double> key_generation_overhead;
+                if (test["key_distribution"].IsDefined() && !userspace) {
+                    key_generation_overhead = measure_key_generation_overhead(
+                        obj, test["program_cpu_assignment"], cpu_program_assignments, parameters);
+                    map_state_modified = true;
                 }
 
-                int program_fd = bpf_program__fd(program);
+                // Measure the cost of the timer that the latency histogram doesn't separate from the latencies.
+                std::optional<double> timer_overhead;
+                if (timer_object && !userspace) {
+                    timer_overhead =
+                        measure_timer_overhead(timer_object, cpu_program_assignments, parameters, baseline_durations);
+                }
 
-                // Check if assignment is scalar or sequence
-                if (assignment.second.IsScalar()) {
-                    if (assignment.second.as<std::string>() == "all") {
-                        // Assign program to all CPUs.
-                        for (size_t i = 0; i < cpu_program_assignments.size(); i++) {
-                            cpu_program_assignments[i] = {program_fd};
-                        }
-                    } else if (assignment.second.as<std::string>() == "remaining") {
-                        // Assign program to all remaining CPUs.
-                        for (size_t i = 0; i < cpu_program_assignments.size(); i++) {
-                            if (!cpu_program_assignments[i].has_value()) {
-                                cpu_program_assignments[i] = {program_fd};
+                // Undo the changes made to the maps by calibration or by previous runs of the test.
+                if (map_state_modified) {
+                    backend->restore_map_state(obj, prepared_state->second.snapshot);
+                }
+                map_state_modified = true;
+
+                auto now = std::chrono::system_clock::now();
+
+                // Per trial average across CPUs and per CPU durations across trials.
+                std::vector<double> trial_durations;
+                std::vector<std::vector<double>> cpu_durations(cpu_count);
+                // Per trial aggregate throughput and window during which all CPUs were active.
+                std::vector<double> trial_throughputs;
+                std::vector<double> trial_concurrent_windows;
+                // Per trial average across CPUs without the background workload, and operations per second of the
+                // background workload.
+                std::vector<double> trial_quiet_durations;
+                std::vector<double> trial_control_plane_throughputs;
+                // Per trial records and bytes consumed per second and fraction of records dropped, and the latency
+                // samples of all trials.
+                std::vector<double> trial_consumed_records;
+                std::vector<double> trial_consumed_bytes;
+                std::vector<double> trial_drop_rates;
+                std::vector<double> latency_samples;
+                // Per trial records produced and drained per second, and program time per drained record.
+                std::vector<double> trial_produced_records;
+                std::vector<double> trial_drained_records;
+                std::vector<double> trial_drain_costs;
+                // Kernel run time and run count of the programs across all trials.
+                program_run_statistics run_time_statistics;
+                // Hardware events counted across all trials and CPUs, and the number of invocations each was counted
+                // over.
+                std::array<double, hardware_counter_event_count> event_totals = {};
+                std::array<double, hardware_counter_event_count> event_iterations = {};
+                // Latency histogram counts of all trials.
+                std::vector<uint64_t> latency_histogram(latency_histogram_bucket_count);
+
+                for (int trial = 0; trial < trials; trial++) {
+                    if (background) {
+                        // Run the test without the background workload first, then again from the same map state
+                        // with it.
+                        auto quiet_result = run_test();
+                        uint64_t quiet_total_duration = 0;
+                        uint64_t quiet_total_count = 0;
+                        for (size_t i = 0; i < quiet_result.opts.size(); i++) {
+                            if (cpu_program_assignments[i].has_value()) {
+                                quiet_total_duration += quiet_result.opts[i].duration;
+                                quiet_total_count++;
                             }
                         }
-                    } else {
-                        int cpu = assignment.second.as<int>();
-                        if (cpu > cpu_count) {
-                            throw std::runtime_error("Invalid CPU number " + std::to_string(cpu));
+                        trial_quiet_durations.push_back(
+                            quiet_total_count ? static_cast<double>(quiet_total_duration) / quiet_total_count : 0);
+                        backend->restore_map_state(obj, prepared_state->second.snapshot);
+                        background->start();
+                    }
+                    if (consumer) {
+                        consumer->start();
+                    }
+                    if (producer) {
+                        producer->start();
+                    }
+                    std::vector<uint64_t> latency_histogram_before;
+                    if (latency_histogram_map) {
+                        latency_histogram_before = read_latency_histogram(obj, *latency_histogram_map);
+                    }
+                    program_run_statistics run_time_statistics_before;
+                    if (report_run_time_statistics && !userspace) {
+                        run_time_statistics_before = read_program_run_statistics(cpu_program_assignments);
+                    }
+                    auto result = run_test();
+                    if (report_run_time_statistics && !userspace) {
+                        auto run_time_statistics_after = read_program_run_statistics(cpu_program_assignments);
+                        run_time_statistics.run_time_ns +=
+                            run_time_statistics_after.run_time_ns - run_time_statistics_before.run_time_ns;
+                        run_time_statistics.run_count +=
+                            run_time_statistics_after.run_count - run_time_statistics_before.run_count;
+                    }
+                    if (latency_histogram_map) {
+                        auto latency_histogram_after = read_latency_histogram(obj, *latency_histogram_map);
+                        for (size_t i = 0; i < latency_histogram.size(); i++) {
+                            latency_histogram[i] += latency_histogram_after[i] - latency_histogram_before[i];
                         }
-                        cpu_program_assignments[assignment.as<int>()] = {program_fd};
                     }
-                } else if (assignment.second.IsSequence()) {
-                    for (auto cpu_assignment : assignment.second) {
-                        int cpu = cpu_assignment.as<int>();
-                        if (cpu > cpu_count) {
-                            throw std::runtime_error("Invalid CPU number " + std::to_string(cpu));
+                    if (consumer) {
+                        // Each program invocation produces one record, which was dropped if it wasn't consumed.
+                        auto consumed = consumer->stop();
+                        auto elapsed = std::chrono::duration<double>(consumed.end_time - result.start_time).count();
+                        trial_consumed_records.push_back(elapsed > 0 ? consumed.record_count / elapsed : 0);
+                        trial_consumed_bytes.push_back(elapsed > 0 ? consumed.byte_count / elapsed : 0);
+                        trial_drop_rates.push_back(
+                            result.total_iterations > consumed.record_count
+                                ? static_cast<double>(result.total_iterations - consumed.record_count) /
+                                      result.total_iterations
+                                : 0);
+                        latency_samples.insert(
+                            latency_samples.end(), consumed.latency_samples.begin(), consumed.latency_samples.end());
+                    }
+                    if (producer) {
+                        auto produced = producer->stop();
+                        auto producer_elapsed =
+                            std::chrono::duration<double>(produced.end_time - produced.start_time).count();
+                        trial_produced_records.push_back(
+                            producer_elapsed > 0 ? produced.record_count / producer_elapsed : 0);
+                        if (produced.drained_count.has_value()) {
+                            // The drain rate is over the window during which the programs ran, and the cost per
+                            // record includes the invocations that found the ring buffer empty.
+                            double program_time = 0;
+                            size_t program_count = 0;
+                            for (size_t i = 0; i < result.opts.size(); i++) {
+                                if (cpu_program_assignments[i].has_value()) {
+                                    program_time += result.opts[i].duration;
+                                    program_count++;
+                                }
+                            }
+                            if (program_count) {
+                                program_time = program_time / program_count * result.total_iterations;
+                            }
+                            double drained = static_cast<double>(*produced.drained_count);
+                            auto elapsed = std::chrono::duration<double>(result.last_end_time - result.start_time);
+                            trial_drained_records.push_back(elapsed.count() > 0 ? drained / elapsed.count() : 0);
+                            trial_drain_costs.push_back(drained > 0 ? program_time / drained : 0);
                         }
-                        cpu_program_assignments[cpu] = {program_fd};
                     }
-                } else {
-                    throw std::runtime_error("Invalid program_cpu_assignment - must be string or sequence");
-                }
-            }
-
-            // Run the pre-test command if specified.
-            if (pre_test_command.has_value()) {
-                std::string command = pre_test_command.value();
-                std::string command_output;
-                command = std::regex_replace(command, std::regex("%NAME%"), name);
-                command = std::regex_replace(command, std::regex("%ELF_FILE%"), elf_file);
-                command = std::regex_replace(command, std::regex("%ITERATION_COUNT%"), std::to_string(iteration_count));
-                command = std::regex_replace(command, std::regex("%CPU_COUNT%"), std::to_string(cpu_count));
-                command = std::regex_replace(command, std::regex("%BATCH_SIZE%"), std::to_string(batch_size));
-                if (run_command_and_capture_output(command, command_output) != 0) {
-                    std::cerr << "Pre-test command failed: " << command << std::endl;
-                    std::cerr << command_output << std::endl;
-                }
-            }
-
-            auto now = std::chrono::system_clock::now();
+                    if (background) {
+                        trial_control_plane_throughputs.push_back(background->stop());
+                        backend->restore_map_state(obj, prepared_state->second.snapshot);
+                    }
+                    auto& opts = result.opts;
+                    trial_throughputs.push_back(result.aggregate_throughput());
+                    trial_concurrent_windows.push_back(
+                        std::chrono::duration<double, std::milli>(result.concurrent_window()).count());
+
+                    uint64_t total_duration = 0;
+                    uint64_t total_count = 0;
+                    for (size_t i = 0; i < opts.size(); i++) {
+                        if (!cpu_program_assignments[i].has_value()) {
+                            continue;
+                        }
+                        auto& opt = opts[i];
+
+                        // Check if the program returned unexpected result.
+                        if (opt.retval != expected_result) {
+                            std::string message = "Program returned unexpected result " + std::to_string(opt.retval) +
+                                                  " in test " + name + " expected " + std::to_string(expected_result);
+                            if (ignore_return_code.value_or(false)) {
+                                std::cout << message << std::endl;
+                            } else {
+                                throw std::runtime_error(message);
+                            }
+                        }
 
-            // Run each entry point via bpf_prog_test_run_opts in a thread.
-            std::vector<std::jthread> threads;
-            std::vector<bpf_test_run_opts> opts(cpu_count);
+                        total_duration += opt.duration;
+                        total_count++;
+                        cpu_durations[i].push_back(static_cast<double>(opt.duration));
 
-            for (size_t i = 0; i < cpu_program_assignments.size(); i++) {
-                if (!cpu_program_assignments[i].has_value()) {
-                    continue;
+                        if (!result.counters.empty()) {
+                            for (size_t event = 0; event < hardware_counter_event_count; event++) {
+                                if (result.counters[i][event].has_value()) {
+                                    event_totals[event] += *result.counters[i][event];
+                                    event_iterations[event] += parameters.repeat;
+                                }
+                            }
+                        }
+                    }
+                    trial_durations.push_back(total_count ? static_cast<double>(total_duration) / total_count : 0);
                 }
-                auto program = cpu_program_assignments[i].value();
-                auto& opt = opts[i];
 
-                threads.emplace_back([=, &opt](std::stop_token stop_token) {
-                    memset(&opt, 0, sizeof(opt));
-                    std::vector<uint8_t> data_in(1024);
-                    std::vector<uint8_t> data_out(1024);
+                // Run the post-test command if specified.
+                if (post_test_command.has_value()) {
+                    std::string command = post_test_command.value();
+                    std::string command_output;
+                    command = std::regex_replace(command, std::regex("%NAME%"), name);
+                    command = std::regex_replace(command, std::regex("%ELF_FILE%"), elf_file);
+                    command =
+                        std::regex_replace(command, std::regex("%ITERATION_COUNT%"), std::to_string(parameters.repeat));
+                    command = std::regex_replace(command, std::regex("%CPU_COUNT%"), std::to_string(active_cpu_count));
+                    command = std::regex_replace(command, std::regex("%BATCH_SIZE%"), std::to_string(batch_size));
+
+                    if (run_command_and_capture_output(command, command_output) != 0) {
+                        std::cerr << "Post-test command failed: " << command << std::endl;
+                        std::cerr << command_output << std::endl;
+                    }
+                }
 
-                    opt.sz = sizeof(opt);
-                    opt.repeat = iteration_count_override.value_or(iteration_count);
-                    opt.cpu = static_cast<uint32_t>(i);
-                    if (pass_data) {
-                        opt.data_in = data_in.data();
-                        opt.data_out = data_out.data();
-                        opt.data_size_in = static_cast<uint32_t>(data_in.size());
-                        opt.data_size_out = static_cast<uint32_t>(data_out.size());
+                // Print a CSV header if not already printed.
+                if (!csv_header_printed) {
+                    std::vector<std::string> header = {"Timestamp", "Test", "Average Duration (ns)"};
+                    for (int i = 0; i < cpu_count; i++) {
+                        header.push_back("CPU " + std::to_string(i) + " Duration (ns)");
                     }
-                    if (pass_context) {
-                        opt.ctx_in = data_in.data();
-                        opt.ctx_out = data_out.data();
-                        opt.ctx_size_in = static_cast<uint32_t>(data_in.size());
-                        opt.ctx_size_out = static_cast<uint32_t>(data_out.size());
+                    header.push_back("Aggregate Throughput (ops/s)");
+                    header.push_back("All CPUs Active Window (ms)");
+                    if (sweep) {
+                        header.push_back("CPU Count");
+                        header.push_back("Speedup");
+                        header.push_back("Parallel Efficiency");
                     }
-#if defined(HAS_BPF_TEST_RUN_OPTS_BATCH_SIZE)
-                    opt.batch_size = batch_size;
-#endif
-
-                    int result = bpf_prog_test_run_opts(program, &opt);
-                    if (result < 0) {
-                        opt.retval = result;
+                    if (target_time.has_value()) {
+                        header.push_back("Iteration Count");
                     }
-                });
-            }
-            for (auto& thread : threads) {
-                thread.join();
-            }
+                    if (report_run_time_statistics) {
+                        header.push_back("Kernel Run Time (ns)");
+                        header.push_back("Kernel Run Count");
+                        header.push_back("Harness Overhead (ns)");
+                    }
+                    if (count_hardware_events) {
+                        header.push_back("IPC");
+                        header.push_back("Cycles per Op");
+                        header.push_back("L1D Misses per Op");
+                        header.push_back("LLC Misses per Op");
+                        header.push_back("dTLB Misses per Op");
+                        header.push_back("Branch Misses per Op");
+                        header.push_back("Task Clock per Op (ns)");
+                        header.push_back("Context Switches per Trial");
+                        header.push_back("Page Faults per Trial");
+                    }
+                    if (report_map_state_preparation) {
+                        header.push_back("Map State Preparation (ms)");
+                    }
+                    if (report_key_generation_overhead) {
+                        header.push_back("RNG Overhead Removed (ns)");
+                    }
+                    if (report_ring_buffer_consumer) {
+                        header.push_back("Consumed Records (records/s)");
+                        header.push_back("Consumed Bytes (bytes/s)");
+                        header.push_back("Drop Rate");
+                        header.push_back("Mean Latency (ns)");
+                        header.push_back("P50 Latency (ns)");
+                        header.push_back("P99 Latency (ns)");
+                    }
+                    if (report_user_ring_buffer_producer) {
+                        header.push_back("Produced Records (records/s)");
+                        header.push_back("Drained Records (records/s)");
+                        header.push_back("Drain Cost (ns/record)");
+                    }
+                    if (report_latency_histogram) {
+                        header.push_back("Timer Overhead (ns)");
+                        header.push_back("Histogram P50 (ns)");
+                        header.push_back("Histogram P99 (ns)");
+                        header.push_back("Histogram P99.9 (ns)");
+                    }
+                    if (report_background_workload) {
+                        header.push_back("Quiet Average Duration (ns)");
+                        header.push_back("Datapath Slowdown");
+                        header.push_back("Control Plane Throughput (ops/s)");
+                    }
+                    if (baseline_elf_file.has_value()) {
+                        header.push_back("Baseline Duration (ns)");
+                        header.push_back("Net Average Duration (ns)");
+                        for (int i = 0; i < cpu_count; i++) {
+                            header.push_back("CPU " + std::to_string(i) + " Net Duration (ns)");
+                        }
+                    }
+                    if (report_trial_statistics) {
+                        header.push_back("Trials");
+                        for (const auto& column : trial_statistics_columns) {
+                            header.push_back(column + " (ns)");
+                        }
+                        for (int i = 0; i < cpu_count; i++) {
+                            for (const auto& column : trial_statistics_columns) {
+                                header.push_back("CPU " + std::to_string(i) + " " + column + " (ns)");
+                            }
+                        }
+                    }
+                    std::cout << join_csv(header) << std::endl;
+                    csv_header_printed = true;
+                }
 
-            // Check if any program returned unexpected result.
-            for (auto& opt : opts) {
-                if (opt.retval != expected_result) {
-                    std::string message =
-                        "Program returned unexpected result " + std::to_string(opt.retval) + " in test " + name + " expected " + std::to_string(expected_result);
-                    if (ignore_return_code.value_or(false)) {
-                        std::cout << message << std::endl;
+                // Print the average execution time for each program on each CPU.
+                // With multiple trials, the durations are the mean across all trials.
+                auto test_statistics = summarize(trial_durations);
+                std::string row_name = name;
+                if (sweep) {
+                    row_name += " (" + std::to_string(active_cpu_count) + (active_cpu_count == 1 ? " CPU)" : " CPUs)");
+                }
+                std::vector<std::string> row = {
+                    to_iso8601(now), row_name, std::to_string(static_cast<uint64_t>(test_statistics.mean))};
+                std::vector<summary_statistics> cpu_statistics;
+                for (int i = 0; i < cpu_count; i++) {
+                    cpu_statistics.push_back(summarize(cpu_durations[i]));
+                    row.push_back(
+                        cpu_durations[i].empty() ? "" : std::to_string(static_cast<uint64_t>(cpu_statistics[i].mean)));
+                }
+                double throughput = summarize(trial_throughputs).mean;
+                row.push_back(std::to_string(static_cast<uint64_t>(throughput)));
+                row.push_back(format_double(summarize(trial_concurrent_windows).mean));
+                if (sweep) {
+                    // Speedup relative to the single CPU run and speedup per CPU.
+                    if (active_cpu_count == 1) {
+                        single_cpu_throughput = throughput;
+                    }
+                    double speedup = single_cpu_throughput > 0 ? throughput / single_cpu_throughput : 0;
+                    row.push_back(std::to_string(active_cpu_count));
+                    row.push_back(format_double(speedup));
+                    row.push_back(format_double(speedup / active_cpu_count));
+                }
+                if (target_time.has_value()) {
+                    row.push_back(std::to_string(parameters.repeat));
+                }
+                if (report_run_time_statistics) {
+                    // Mean run time per invocation as the kernel measures it, and the rest of the duration reported
+                    // by bpf_prog_test_run_opts, which is spent in its loop.
+                    if (run_time_statistics.run_count > 0) {
+                        double run_time = static_cast<double>(run_time_statistics.run_time_ns) /
+                                          run_time_statistics.run_count;
+                        row.push_back(format_double(run_time));
+                        row.push_back(std::to_string(run_time_statistics.run_count));
+                        row.push_back(format_double(test_statistics.mean - run_time));
                     } else {
-                        throw std::runtime_error(message);
+                        row.insert(row.end(), 3, "");
                     }
                 }
-            }
-
-            // Run the post-test command if specified.
-            if (post_test_command.has_value()) {
-                std::string command = post_test_command.value();
-                std::string command_output;
-                command = std::regex_replace(command, std::regex("%NAME%"), name);
-                command = std::regex_replace(command, std::regex("%ELF_FILE%"), elf_file);
-                command = std::regex_replace(command, std::regex("%ITERATION_COUNT%"), std::to_string(iteration_count));
-                command = std::regex_replace(command, std::regex("%CPU_COUNT%"), std::to_string(cpu_count));
-                command = std::regex_replace(command, std::regex("%BATCH_SIZE%"), std::to_string(batch_size));
-
-                if (run_command_and_capture_output(command, command_output) != 0) {
-                    std::cerr << "Post-test command failed: " << command << std::endl;
-                    std::cerr << command_output << std::endl;
+                if (count_hardware_events) {
+                    // Events that couldn't be counted, such as hardware events in most virtual machines, are left
+                    // empty.
+                    auto per_op = [&](hardware_counter_event event) -> std::string {
+                        if (event_iterations[event] == 0) {
+                            return "";
+                        }
+                        return format_double(event_totals[event] / event_iterations[event]);
+                    };
+                    auto per_trial = [&](hardware_counter_event event) -> std::string {
+                        return event_iterations[event] > 0 ? format_double(event_totals[event] / trials) : "";
+                    };
+                    double cycles = event_totals[hardware_counter_cycles];
+                    double instructions = event_totals[hardware_counter_instructions];
+                    bool has_ipc = event_iterations[hardware_counter_cycles] > 0 &&
+                                   event_iterations[hardware_counter_instructions] > 0 && cycles > 0;
+                    row.push_back(has_ipc ? format_double(instructions / cycles) : "");
+                    row.push_back(per_op(hardware_counter_cycles));
+                    row.push_back(per_op(hardware_counter_l1d_misses));
+                    row.push_back(per_op(hardware_counter_llc_misses));
+                    row.push_back(per_op(hardware_counter_dtlb_misses));
+                    row.push_back(per_op(hardware_counter_branch_misses));
+                    row.push_back(per_op(hardware_counter_task_clock));
+                    row.push_back(per_trial(hardware_counter_context_switches));
+                    row.push_back(per_trial(hardware_counter_page_faults));
                 }
-            }
-
-            // Print a CSV header if not already printed.
-            if (!csv_header_printed) {
-                std::cout << "Timestamp,";
-                std::cout << "Test,";
-                std::cout << "Average Duration (ns),";
-                for (size_t i = 0; i < opts.size(); i++) {
-                    if (!cpu_program_assignments[i].has_value()) {
-                        continue;
+                if (report_map_state_preparation) {
+                    row.push_back(map_state_preparation ? format_double(map_state_preparation_time) : "");
+                }
+                if (report_key_generation_overhead) {
+                    row.push_back(key_generation_overhead ? format_double(*key_generation_overhead) : "");
+                }
+                if (report_ring_buffer_consumer) {
+                    if (consumer) {
+                        row.push_back(std::to_string(static_cast<uint64_t>(summarize(trial_consumed_records).mean)));
+                        row.push_back(std::to_string(static_cast<uint64_t>(summarize(trial_consumed_bytes).mean)));
+                        row.push_back(format_double(summarize(trial_drop_rates).mean));
+                        if (latency_samples.empty()) {
+                            row.insert(row.end(), 3, "");
+                        } else {
+                            std::sort(latency_samples.begin(), latency_samples.end());
+                            row.push_back(format_double(summarize(latency_samples).mean));
+                            row.push_back(format_double(percentile(latency_samples, 50)));
+                            row.push_back(format_double(percentile(latency_samples, 99)));
+                        }
+                    } else {
+                        row.insert(row.end(), 6, "");
+                    }
+                }
+                if (report_user_ring_buffer_producer) {
+                    if (producer) {
+                        row.push_back(std::to_string(static_cast<uint64_t>(summarize(trial_produced_records).mean)));
+                        if (trial_drained_records.empty()) {
+                            row.insert(row.end(), 2, "");
+                        } else {
+                            row.push_back(std::to_string(static_cast<uint64_t>(summarize(trial_drained_records).mean)));
+                            row.push_back(format_double(summarize(trial_drain_costs).mean));
+                        }
+                    } else {
+                        row.insert(row.end(), 3, "");
+                    }
+                }
+                if (report_latency_histogram) {
+                    if (latency_histogram_map) {
+                        // Percentiles of the latencies of all trials, less the cost of the timer.
+                        row.push_back(timer_overhead ? format_double(*timer_overhead) : "");
+                        for (double percentile : {50.0, 99.0, 99.9}) {
+                            double latency = latency_histogram_percentile(latency_histogram, percentile);
+                            row.push_back(format_double(std::max(latency - timer_overhead.value_or(0), 0.0)));
+                        }
+                    } else {
+                        row.insert(row.end(), 4, "");
+                    }
+                }
+                if (report_background_workload) {
+                    if (background) {
+                        // Ratio of the duration with the background workload to the duration without it.
+                        double quiet_duration = summarize(trial_quiet_durations).mean;
+                        row.push_back(format_double(quiet_duration));
+                        row.push_back(quiet_duration > 0 ? format_double(test_statistics.mean / quiet_duration) : "");
+                        row.push_back(std::to_string(
+                            static_cast<uint64_t>(summarize(trial_control_plane_throughputs).mean)));
+                    } else {
+                        row.insert(row.end(), 3, "");
+                    }
+                }
+                if (baseline_elf_file.has_value()) {
+                    // Subtract the baseline of each CPU from the mean duration of the test on that CPU.
+                    double baseline_total = 0;
+                    double net_total = 0;
+                    size_t assigned_cpus = 0;
+                    std::vector<std::string> net_durations;
+                    for (int i = 0; i < cpu_count; i++) {
+                        if (cpu_durations[i].empty() || baseline_durations.empty()) {
+                            net_durations.push_back("");
+                            continue;
+                        }
+                        double net_duration = cpu_statistics[i].mean - baseline_durations[i];
+                        baseline_total += baseline_durations[i];
+                        net_total += net_duration;
+                        assigned_cpus++;
+                        net_durations.push_back(format_double(net_duration));
+                    }
+                    row.push_back(assigned_cpus ? format_double(baseline_total / assigned_cpus) : "");
+                    row.push_back(assigned_cpus ? format_double(net_total / assigned_cpus) : "");
+                    row.insert(row.end(), net_durations.begin(), net_durations.end());
+                }
+                if (report_trial_statistics) {
+                    auto append_statistics = [&row](const summary_statistics& statistics) {
+                        if (statistics.count == 0) {
+                            row.insert(row.end(), trial_statistics_columns.size(), "");
+                            return;
+                        }
+                        for (auto value :
+                             {statistics.min,
+                              statistics.median,
+                              statistics.mean,
+                              statistics.stddev,
+                              statistics.p95,
+                              statistics.ci95_low,
+                              statistics.ci95_high}) {
+                            row.push_back(format_double(value));
+                        }
+                    };
+                    row.push_back(std::to_string(trials));
+                    append_statistics(test_statistics);
+                    for (const auto& statistics : cpu_statistics) {
+                        append_statistics(statistics);
                     }
-                    std::cout << "CPU " << i << " Duration (ns)";
-                    if (i < opts.size() - 1) {
-                        std::cout << ",";
+                }
+                std::cout << join_csv(row) << std::endl;
+
+                // Report the cost of loading the objects of the test as rows of their own, with the value in the
+                // average duration column, so that load regressions are tracked like run time regressions.
+                for (const auto& statistics : load_statistics) {
+                    for (const auto& [load_row_name, value] : load_statistics_rows(statistics)) {
+                        std::vector<std::string> load_row(row.size());
+                        load_row[0] = to_iso8601(now);
+                        load_row[1] = load_row_name;
+                        load_row[2] = std::to_string(value);
+                        std::cout << join_csv(load_row) << std::endl;
                     }
                 }
-                std::cout << std::endl;
-                csv_header_printed = true;
+                load_statistics.clear();
             }
+        };
 
-            // Print the average execution time for each program on each CPU.
-            std::cout  << to_iso8601(now) << "," << name << ",";
-
-            uint64_t total_duration = 0;
-            uint64_t total_count = 0;
-            for (auto opt : opts) {
-                total_duration += opt.duration;
-                total_count ++;
+        // Close an object loaded with overrides, along with the map states captured from it.
+        auto release_bpf_object = [&](const std::string& object_key) {
+            auto object = bpf_objects.find(object_key);
+            if (object == bpf_objects.end()) {
+                return;
             }
-            std::cout << total_duration / total_count << ",";
-
-            for (size_t i = 0; i < opts.size(); i++) {
-                if (!cpu_program_assignments[i].has_value()) {
-                    continue;
-                }
-                auto& opt = opts[i];
-                std::cout << opt.duration;
-                if (i < opts.size() - 1) {
-                    std::cout << ",";
+            bpf_object* obj = object->second.get();
+            loaded_map_states.erase(obj);
+            std::erase_if(prepared_map_states, [obj](const auto& state) { return state.first.first == obj; });
+            backend->unload(obj);
+            bpf_objects.erase(object);
+        };
+
+        // Run each test. Tests that use a feature, helper or map type that the backend doesn't support are skipped
+        // rather than ending the run.
+        for (size_t i = 0; i < tests.size(); i++) {
+            auto test = tests[i];
+            try {
+                run_test_case(test);
+            } catch (const unsupported_by_backend_error& e) {
+                std::cerr << "Skipping test " << test["name"].as<std::string>() << ": " << e.what() << std::endl;
+            }
+            // Objects loaded by a test that returned early or was skipped aren't reported with the next test.
+            load_statistics.clear();
+            for (const auto& [object_key, last_use] : last_override_uses) {
+                if (last_use == i) {
+                    release_bpf_object(object_key);
                 }
             }
-            std::cout << std::endl;
         }
 
         return 0;
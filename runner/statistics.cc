@@ -0,0 +1,70 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "statistics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+// Two-sided 97.5% quantile of Student's t-distribution for 1 to 30 degrees of freedom.
+static const double t_distribution_975[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131,
+    2.120,  2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+};
+
+static double
+t_critical_value(size_t degrees_of_freedom)
+{
+    if (degrees_of_freedom == 0) {
+        return 0;
+    }
+    if (degrees_of_freedom <= std::size(t_distribution_975)) {
+        return t_distribution_975[degrees_of_freedom - 1];
+    }
+    // Close enough to the normal distribution beyond 30 degrees of freedom.
+    return 1.96;
+}
+
+double
+percentile(const std::vector<double>& sorted_samples, double percentile)
+{
+    if (sorted_samples.empty()) {
+        return 0;
+    }
+    double rank = (percentile / 100.0) * (sorted_samples.size() - 1);
+    size_t lower = static_cast<size_t>(std::floor(rank));
+    size_t upper = static_cast<size_t>(std::ceil(rank));
+    double fraction = rank - lower;
+    return sorted_samples[lower] + (sorted_samples[upper] - sorted_samples[lower]) * fraction;
+}
+
+summary_statistics
+summarize(std::vector<double> samples)
+{
+    summary_statistics statistics;
+    if (samples.empty()) {
+        return statistics;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    statistics.count = samples.size();
+    statistics.min = samples.front();
+    statistics.median = percentile(samples, 50);
+    statistics.p95 = percentile(samples, 95);
+    statistics.mean = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+
+    if (samples.size() > 1) {
+        double sum_of_squares = 0;
+        for (auto sample : samples) {
+            sum_of_squares += (sample - statistics.mean) * (sample - statistics.mean);
+        }
+        // Sample standard deviation (Bessel's correction).
+        statistics.stddev = std::sqrt(sum_of_squares / (samples.size() - 1));
+    }
+
+    double margin = t_critical_value(samples.size() - 1) * statistics.stddev / std::sqrt(samples.size());
+    statistics.ci95_low = statistics.mean - margin;
+    statistics.ci95_high = statistics.mean + margin;
+    return statistics;
+}
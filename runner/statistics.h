@@ -0,0 +1,31 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+// Summary of a set of samples, e.g. the per-trial durations of a test.
+struct summary_statistics
+{
+    size_t count = 0;
+    double min = 0;
+    double median = 0;
+    double mean = 0;
+    double stddev = 0;
+    double p95 = 0;
+    // Two-sided 95% confidence interval of the mean using Student's t-distribution.
+    // Collapses to the mean when there are fewer than two samples.
+    double ci95_low = 0;
+    double ci95_high = 0;
+};
+
+// Compute the summary statistics of the samples.
+summary_statistics
+summarize(std::vector<double> samples);
+
+// Return the requested percentile (0-100) of an already sorted set of samples,
+// interpolating linearly between the closest ranks.
+double
+percentile(const std::vector<double>& sorted_samples, double percentile);
@@ -0,0 +1,666 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "ubpf_backend.h"
+
+#include <stdexcept>
+
+#if defined(HAS_UBPF)
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <list>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+#include <ubpf.h>
+
+// Helper function ids, from enum bpf_func_id.
+const unsigned int helper_map_lookup_elem = 1;
+const unsigned int helper_map_update_elem = 2;
+const unsigned int helper_map_delete_elem = 3;
+const unsigned int helper_ktime_get_ns = 5;
+const unsigned int helper_trace_printk = 6;
+const unsigned int helper_get_prandom_u32 = 7;
+const unsigned int helper_get_smp_processor_id = 8;
+const unsigned int helper_ktime_get_boot_ns = 125;
+
+// CPU the current thread runs programs as, which selects the copy of per CPU values.
+static thread_local uint32_t current_cpu = 0;
+
+// Map emulated in userspace. Values are allocated once and reused, so that the pointers that lookups return to the
+// programs stay valid while other CPUs delete entries, as with the kernel's preallocated maps. When an LRU map is full,
+// the least recently looked up or updated entry is evicted, of which the kernel keeps an approximate order.
+class emulated_map
+{
+  public:
+    explicit emulated_map(const bpf_map* map)
+        : name(bpf_map__name(map)), type(bpf_map__type(map)), key_size(bpf_map__key_size(map)),
+          value_size(bpf_map__value_size(map)), max_entries(bpf_map__max_entries(map)), percpu(is_percpu_map(type)),
+          value_stride(percpu ? (value_size + 7) & ~static_cast<size_t>(7) : value_size),
+          slot_size(map_value_buffer_size(map)), values(max_entries * slot_size)
+    {
+        for (size_t slot = max_entries; slot > 0; slot--) {
+            free_slots.push_back(slot - 1);
+        }
+    }
+
+    // Return true if maps of this type can be emulated.
+    static bool
+    is_supported(const bpf_map* map)
+    {
+        switch (bpf_map__type(map)) {
+        case BPF_MAP_TYPE_HASH:
+        case BPF_MAP_TYPE_ARRAY:
+        case BPF_MAP_TYPE_PERCPU_HASH:
+        case BPF_MAP_TYPE_PERCPU_ARRAY:
+        case BPF_MAP_TYPE_LRU_HASH:
+        case BPF_MAP_TYPE_LRU_PERCPU_HASH:
+        case BPF_MAP_TYPE_LPM_TRIE:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    // Return the value of the key as seen from the CPU, or nullptr if the map doesn't contain it.
+    void*
+    lookup(const void* key, uint32_t cpu)
+    {
+        auto slot = find_slot(key);
+        return slot.has_value() ? values.data() + *slot * slot_size + (percpu ? cpu * value_stride : 0) : nullptr;
+    }
+
+    // Insert or update the value of the key, returning 0 or a negative error as the helper does. Programs update the
+    // copy of their CPU, while userspace passes the copies of all CPUs.
+    int
+    update(const void* key, const void* value, uint64_t flags, std::optional<uint32_t> cpu)
+    {
+        if (is_array()) {
+            uint32_t index = *static_cast<const uint32_t*>(key);
+            if (index >= max_entries) {
+                return -E2BIG;
+            }
+            if (flags == BPF_NOEXIST) {
+                return -EEXIST;
+            }
+            store(index, value, cpu, false);
+            return 0;
+        }
+
+        std::unique_lock lock(mutex);
+        std::string key_bytes = normalize_key(key);
+        auto entry = entries.find(key_bytes);
+        if (entry != entries.end()) {
+            if (flags == BPF_NOEXIST) {
+                return -EEXIST;
+            }
+            store(entry->second.slot, value, cpu, false);
+            touch(entry->second);
+            return 0;
+        }
+        if (flags == BPF_EXIST) {
+            return -ENOENT;
+        }
+        if (free_slots.empty()) {
+            if (!is_lru()) {
+                return -E2BIG;
+            }
+            erase(entries.find(recency.front()));
+        }
+        size_t slot = free_slots.back();
+        free_slots.pop_back();
+        store(slot, value, cpu, true);
+        recency.push_back(key_bytes);
+        entries.insert({key_bytes, {slot, std::prev(recency.end())}});
+        if (type == BPF_MAP_TYPE_LPM_TRIE) {
+            prefix_lengths[prefix_length(key)]++;
+        }
+        return 0;
+    }
+
+    // Delete the key, returning 0 or a negative error as the helper does.
+    int
+    remove(const void* key)
+    {
+        if (is_array()) {
+            return -EINVAL;
+        }
+        std::unique_lock lock(mutex);
+        auto entry = entries.find(normalize_key(key));
+        if (entry == entries.end()) {
+            return -ENOENT;
+        }
+        erase(entry);
+        return 0;
+    }
+
+    // Return all entries, with the values of per CPU maps laid out as the kernel copies them to userspace.
+    map_entries
+    read_entries()
+    {
+        std::shared_lock lock(mutex);
+        map_entries result;
+        result.key_size = key_size;
+        result.value_size = slot_size;
+        auto append = [&](const void* key, size_t slot) {
+            auto key_bytes = static_cast<const uint8_t*>(key);
+            result.keys.insert(result.keys.end(), key_bytes, key_bytes + key_size);
+            result.values.insert(
+                result.values.end(), values.begin() + slot * slot_size, values.begin() + (slot + 1) * slot_size);
+        };
+        if (is_array()) {
+            for (uint32_t index = 0; index < max_entries; index++) {
+                append(&index, index);
+            }
+        } else {
+            for (const auto& [key_bytes, entry] : entries) {
+                append(key_bytes.data(), entry.slot);
+            }
+        }
+        return result;
+    }
+
+    // Remove all entries. Array entries can't be removed and are left as they are.
+    void
+    clear()
+    {
+        std::unique_lock lock(mutex);
+        while (!entries.empty()) {
+            erase(entries.begin());
+        }
+    }
+
+    const std::string name;
+
+  private:
+    struct entry
+    {
+        size_t slot;
+        std::list<std::string>::iterator age;
+    };
+
+    bool
+    is_array() const
+    {
+        return type == BPF_MAP_TYPE_ARRAY || type == BPF_MAP_TYPE_PERCPU_ARRAY;
+    }
+
+    bool
+    is_lru() const
+    {
+        return type == BPF_MAP_TYPE_LRU_HASH || type == BPF_MAP_TYPE_LRU_PERCPU_HASH;
+    }
+
+    // Make the entry of an LRU map the most recently used one. Must be called with the mutex held exclusively.
+    void
+    touch(entry& used)
+    {
+        if (is_lru()) {
+            recency.splice(recency.end(), recency, used.age);
+        }
+    }
+
+    // Prefix length of an LPM trie key, capped to the number of bits of its data.
+    uint32_t
+    prefix_length(const void* key) const
+    {
+        uint32_t length;
+        memcpy(&length, key, sizeof(length));
+        return std::min<uint32_t>(length, static_cast<uint32_t>((key_size - sizeof(length)) * 8));
+    }
+
+    // Return the key of an LPM trie with its prefix length capped and the bits beyond its prefix cleared, and other
+    // keys as they are.
+    std::string
+    normalize_key(const void* key) const
+    {
+        std::string key_bytes(static_cast<const char*>(key), key_size);
+        if (type == BPF_MAP_TYPE_LPM_TRIE) {
+            mask_key(key_bytes, prefix_length(key));
+        }
+        return key_bytes;
+    }
+
+    static void
+    mask_key(std::string& key_bytes, uint32_t length)
+    {
+        memcpy(key_bytes.data(), &length, sizeof(length));
+        for (size_t bit = length; bit < (key_bytes.size() - sizeof(length)) * 8; bit++) {
+            key_bytes[sizeof(length) + bit / 8] &= static_cast<char>(~(0x80 >> (bit % 8)));
+        }
+    }
+
+    std::optional<size_t>
+    find_slot(const void* key)
+    {
+        if (is_array()) {
+            uint32_t index = *static_cast<const uint32_t*>(key);
+            return index < max_entries ? std::optional<size_t>(index) : std::nullopt;
+        }
+        if (is_lru()) {
+            // Lookups change the eviction order, so they need exclusive access.
+            std::unique_lock lock(mutex);
+            auto entry = entries.find(std::string(static_cast<const char*>(key), key_size));
+            if (entry == entries.end()) {
+                return std::nullopt;
+            }
+            touch(entry->second);
+            return entry->second.slot;
+        }
+        std::shared_lock lock(mutex);
+        if (type != BPF_MAP_TYPE_LPM_TRIE) {
+            auto entry = entries.find(std::string(static_cast<const char*>(key), key_size));
+            return entry != entries.end() ? std::optional<size_t>(entry->second.slot) : std::nullopt;
+        }
+        // Longest prefix match: try the prefix lengths in the map, longest first, up to that of the key.
+        uint32_t key_length = prefix_length(key);
+        std::string key_bytes(static_cast<const char*>(key), key_size);
+        for (const auto& [length, count] : prefix_lengths) {
+            if (length > key_length) {
+                continue;
+            }
+            mask_key(key_bytes, length);
+            auto entry = entries.find(key_bytes);
+            if (entry != entries.end()) {
+                return entry->second.slot;
+            }
+        }
+        return std::nullopt;
+    }
+
+    void
+    store(size_t slot, const void* value, std::optional<uint32_t> cpu, bool new_entry)
+    {
+        uint8_t* destination = values.data() + slot * slot_size;
+        if (!cpu.has_value() || !percpu) {
+            memcpy(destination, value, cpu.has_value() ? value_size : slot_size);
+            return;
+        }
+        if (new_entry) {
+            memset(destination, 0, slot_size);
+        }
+        memcpy(destination + *cpu * value_stride, value, value_size);
+    }
+
+    void
+    erase(std::unordered_map<std::string, entry>::iterator entry)
+    {
+        if (type == BPF_MAP_TYPE_LPM_TRIE) {
+            auto length = prefix_lengths.find(prefix_length(entry->first.data()));
+            if (--length->second == 0) {
+                prefix_lengths.erase(length);
+            }
+        }
+        free_slots.push_back(entry->second.slot);
+        recency.erase(entry->second.age);
+        entries.erase(entry);
+    }
+
+    const bpf_map_type type;
+    const size_t key_size;
+    const size_t value_size;
+    const size_t max_entries;
+    const bool percpu;
+    const size_t value_stride;
+    const size_t slot_size;
+    std::vector<uint8_t> values;
+    std::vector<size_t> free_slots;
+    std::unordered_map<std::string, entry> entries;
+    // Keys of the entries from the least to the most recently used, which only LRU maps evict by.
+    std::list<std::string> recency;
+    // Number of entries of each prefix length of an LPM trie, longest first.
+    std::map<uint32_t, size_t, std::greater<uint32_t>> prefix_lengths;
+    std::shared_mutex mutex;
+};
+
+static uint64_t
+map_lookup_elem(uint64_t map, uint64_t key, uint64_t, uint64_t, uint64_t)
+{
+    auto value = reinterpret_cast<emulated_map*>(map)->lookup(reinterpret_cast<const void*>(key), current_cpu);
+    return reinterpret_cast<uint64_t>(value);
+}
+
+static uint64_t
+map_update_elem(uint64_t map, uint64_t key, uint64_t value, uint64_t flags, uint64_t)
+{
+    return static_cast<uint64_t>(static_cast<int64_t>(reinterpret_cast<emulated_map*>(map)->update(
+        reinterpret_cast<const void*>(key), reinterpret_cast<const void*>(value), flags, current_cpu)));
+}
+
+static uint64_t
+map_delete_elem(uint64_t map, uint64_t key, uint64_t, uint64_t, uint64_t)
+{
+    return static_cast<uint64_t>(
+        static_cast<int64_t>(reinterpret_cast<emulated_map*>(map)->remove(reinterpret_cast<const void*>(key))));
+}
+
+static uint64_t
+ktime_get_ns(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+static uint64_t
+trace_printk(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t)
+{
+    return 0;
+}
+
+static uint64_t
+get_prandom_u32(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t)
+{
+    static thread_local std::minstd_rand generator(std::random_device{}());
+    return static_cast<uint32_t>(generator());
+}
+
+static uint64_t
+get_smp_processor_id(uint64_t, uint64_t, uint64_t, uint64_t, uint64_t)
+{
+    return current_cpu;
+}
+
+struct ubpf_vm_deleter
+{
+    void
+    operator()(ubpf_vm* vm) const
+    {
+        ubpf_destroy(vm);
+    }
+};
+
+// Runs the programs in the uBPF VM, with one VM per program shared by all CPUs.
+class ubpf_backend : public execution_backend
+{
+  public:
+    explicit ubpf_backend(bool jit) : jit(jit) {}
+
+    std::string
+    name() const override
+    {
+        return jit ? "ubpf-jit" : "ubpf";
+    }
+
+    bool
+    runs_in_kernel() const override
+    {
+        return false;
+    }
+
+    void
+    load(bpf_object* obj, const std::string& elf_file) override
+    {
+        std::ifstream file(elf_file, std::ios::binary);
+        std::vector<char> elf((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (!file.good() && !file.eof()) {
+            throw std::runtime_error("Failed to read BPF object " + elf_file);
+        }
+
+        bpf_map* map;
+        bpf_object__for_each_map(map, obj)
+        {
+            if (!bpf_map__is_internal(map) && emulated_map::is_supported(map)) {
+                maps[map] = std::make_unique<emulated_map>(map);
+            }
+        }
+
+        // Programs that can't be loaded, e.g. because they call helpers that aren't emulated, only fail the tests that
+        // run them.
+        relocation_context context = {this, obj, {}, {}};
+        bpf_program* program;
+        bpf_object__for_each_program(program, obj)
+        {
+            loaded_program loaded;
+            loaded.name = bpf_program__name(program);
+            loaded.vm.reset(ubpf_create());
+            if (!loaded.vm) {
+                throw std::runtime_error("Failed to create a uBPF VM");
+            }
+            // Programs access map values and the stack, which the bounds check doesn't know about.
+            ubpf_toggle_bounds_check(loaded.vm.get(), false);
+            ubpf_register(loaded.vm.get(), helper_map_lookup_elem, "bpf_map_lookup_elem", map_lookup_elem);
+            ubpf_register(loaded.vm.get(), helper_map_update_elem, "bpf_map_update_elem", map_update_elem);
+            ubpf_register(loaded.vm.get(), helper_map_delete_elem, "bpf_map_delete_elem", map_delete_elem);
+            ubpf_register(loaded.vm.get(), helper_ktime_get_ns, "bpf_ktime_get_ns", ktime_get_ns);
+            ubpf_register(loaded.vm.get(), helper_trace_printk, "bpf_trace_printk", trace_printk);
+            ubpf_register(loaded.vm.get(), helper_get_prandom_u32, "bpf_get_prandom_u32", get_prandom_u32);
+            ubpf_register(
+                loaded.vm.get(), helper_get_smp_processor_id, "bpf_get_smp_processor_id", get_smp_processor_id);
+            ubpf_register(loaded.vm.get(), helper_ktime_get_boot_ns, "bpf_ktime_get_boot_ns", ktime_get_ns);
+            ubpf_register_data_relocation(loaded.vm.get(), &context, relocate);
+
+            context.error.clear();
+            char* error_message = nullptr;
+            if (ubpf_load_elf_ex(
+                    loaded.vm.get(), elf.data(), elf.size(), bpf_program__section_name(program), &error_message) < 0) {
+                loaded.error = error_message ? error_message : "failed to load the program";
+            } else if (!context.error.empty()) {
+                loaded.error = context.error;
+            } else if (jit) {
+                loaded.jitted = ubpf_compile(loaded.vm.get(), &error_message);
+                if (!loaded.jitted) {
+                    loaded.error = error_message ? error_message : "failed to JIT compile the program";
+                }
+            }
+            free(error_message);
+
+            program_handles[program] = static_cast<int>(programs.size());
+            programs.push_back(std::move(loaded));
+        }
+    }
+
+    void
+    unload(const bpf_object* obj) override
+    {
+        bpf_map* map;
+        bpf_object__for_each_map(map, obj)
+        {
+            maps.erase(map);
+        }
+
+        // Handles index programs, so the slot of each program is kept but its VM is freed.
+        bpf_program* program;
+        bpf_object__for_each_program(program, obj)
+        {
+            auto handle = program_handles.find(program);
+            if (handle != program_handles.end()) {
+                auto& loaded = programs[handle->second];
+                loaded.jitted = nullptr;
+                loaded.vm.reset();
+                loaded.error = "the object was unloaded";
+                program_handles.erase(handle);
+            }
+        }
+    }
+
+    int
+    program_handle(const bpf_program* program) override
+    {
+        auto handle = program_handles.find(program);
+        if (handle == program_handles.end()) {
+            throw std::runtime_error("Program " + std::string(bpf_program__name(program)) + " is not loaded");
+        }
+        const auto& loaded = programs[handle->second];
+        if (!loaded.error.empty()) {
+            throw unsupported_by_backend_error("Failed to load program " + loaded.name + " in uBPF: " + loaded.error);
+        }
+        return handle->second;
+    }
+
+    int
+    test_run(int program, bpf_test_run_opts* opts) override
+    {
+        const auto& loaded = programs.at(program);
+        current_cpu = opts->cpu;
+
+        // The program gets a copy of the context, or else of the data, as its memory.
+        std::vector<uint8_t> memory;
+        if (opts->ctx_in) {
+            auto ctx = static_cast<const uint8_t*>(opts->ctx_in);
+            memory.assign(ctx, ctx + opts->ctx_size_in);
+        } else if (opts->data_in) {
+            auto data = static_cast<const uint8_t*>(opts->data_in);
+            memory.assign(data, data + opts->data_size_in);
+        }
+
+        uint32_t repeat = std::max<uint32_t>(opts->repeat, 1);
+        uint64_t return_value = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < repeat; i++) {
+            if (loaded.jitted) {
+                return_value = loaded.jitted(memory.data(), memory.size());
+            } else if (ubpf_exec(loaded.vm.get(), memory.data(), memory.size(), &return_value) < 0) {
+                return -EINVAL;
+            }
+        }
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+        opts->duration = static_cast<uint32_t>(elapsed.count() / repeat);
+        opts->retval = static_cast<uint32_t>(return_value);
+        if (opts->ctx_out) {
+            opts->ctx_size_out = static_cast<uint32_t>(std::min<size_t>(opts->ctx_size_out, memory.size()));
+            memcpy(opts->ctx_out, memory.data(), opts->ctx_size_out);
+        } else if (opts->data_out) {
+            opts->data_size_out = static_cast<uint32_t>(std::min<size_t>(opts->data_size_out, memory.size()));
+            memcpy(opts->data_out, memory.data(), opts->data_size_out);
+        }
+        return 0;
+    }
+
+    void
+    update_map_entries(const bpf_map* map, map_entries& entries) override
+    {
+        auto& emulated = find_map(map);
+        for (size_t i = 0; i < entries.count(); i++) {
+            int result = emulated.update(
+                entries.keys.data() + i * entries.key_size,
+                entries.values.data() + i * entries.value_size,
+                BPF_ANY,
+                std::nullopt);
+            if (result < 0) {
+                throw std::runtime_error(
+                    "Failed to update map " + emulated.name + " entry " + std::to_string(i) + ": " +
+                    strerror(-result));
+            }
+        }
+    }
+
+    map_state_snapshot
+    snapshot_map_state(const bpf_object* obj) override
+    {
+        map_state_snapshot snapshot;
+        bpf_map* map;
+        bpf_object__for_each_map(map, obj)
+        {
+            auto emulated = maps.find(map);
+            if (emulated != maps.end()) {
+                snapshot[emulated->second->name] = emulated->second->read_entries();
+            }
+        }
+        return snapshot;
+    }
+
+    void
+    restore_map_state(const bpf_object* obj, map_state_snapshot& snapshot) override
+    {
+        bpf_map* map;
+        bpf_object__for_each_map(map, obj)
+        {
+            auto entries = snapshot.find(bpf_map__name(map));
+            if (entries != snapshot.end() && maps.find(map) != maps.end()) {
+                find_map(map).clear();
+                update_map_entries(map, entries->second);
+            }
+        }
+    }
+
+  private:
+    struct loaded_program
+    {
+        std::string name;
+        std::unique_ptr<ubpf_vm, ubpf_vm_deleter> vm;
+        ubpf_jit_fn jitted = nullptr;
+        // Reason the program can't run, if any.
+        std::string error;
+    };
+
+    // State of the relocations of the programs of the object being loaded.
+    struct relocation_context
+    {
+        ubpf_backend* backend;
+        const bpf_object* obj;
+        // Copies of the global data sections, shared by the programs of the object.
+        std::map<const uint8_t*, std::vector<uint8_t>*> data_sections;
+        std::string error;
+    };
+
+    // Resolve a reference to a map or to global data into its address.
+    static uint64_t
+    relocate(
+        void* user_context,
+        const uint8_t* data,
+        uint64_t data_size,
+        const char* symbol_name,
+        uint64_t symbol_offset,
+        uint64_t symbol_size)
+    {
+        (void)symbol_size;
+        auto context = static_cast<relocation_context*>(user_context);
+        auto map = bpf_object__find_map_by_name(context->obj, symbol_name);
+        if (map && !bpf_map__is_internal(map)) {
+            auto emulated = context->backend->maps.find(map);
+            if (emulated == context->backend->maps.end()) {
+                context->error = "map " + std::string(symbol_name) + " has a type that isn't emulated";
+                return 0;
+            }
+            return reinterpret_cast<uint64_t>(emulated->second.get());
+        }
+
+        auto section = context->data_sections.find(data);
+        if (section == context->data_sections.end()) {
+            context->backend->data_sections.push_back(std::make_unique<std::vector<uint8_t>>(data, data + data_size));
+            section = context->data_sections.insert({data, context->backend->data_sections.back().get()}).first;
+        }
+        return reinterpret_cast<uint64_t>(section->second->data() + symbol_offset);
+    }
+
+    emulated_map&
+    find_map(const bpf_map* map)
+    {
+        auto emulated = maps.find(map);
+        if (emulated == maps.end()) {
+            throw unsupported_by_backend_error(
+                "Map " + std::string(bpf_map__name(map)) + " has a type that the " + name() +
+                " backend doesn't emulate");
+        }
+        return *emulated->second;
+    }
+
+    const bool jit;
+    std::map<const bpf_map*, std::unique_ptr<emulated_map>> maps;
+    std::map<const bpf_program*, int> program_handles;
+    std::vector<loaded_program> programs;
+    std::vector<std::unique_ptr<std::vector<uint8_t>>> data_sections;
+};
+#endif
+
+std::unique_ptr<execution_backend>
+create_ubpf_backend(bool jit)
+{
+#if defined(HAS_UBPF)
+    return std::make_unique<ubpf_backend>(jit);
+#else
+    (void)jit;
+    throw std::runtime_error("The ubpf backend requires the runner to be built with uBPF");
+#endif
+}
@@ -0,0 +1,15 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include "execution_backend.h"
+
+#include <memory>
+
+// Create a backend that runs the programs in the uBPF userspace VM, either interpreted or JIT compiled. The helpers
+// that the programs use are emulated: map lookup, update and delete, bpf_ktime_get_ns, bpf_ktime_get_boot_ns,
+// bpf_get_prandom_u32, bpf_get_smp_processor_id and bpf_trace_printk. Hash, array and LPM trie maps, including their
+// per CPU and LRU variants, are emulated in userspace. Throws if the runner was built without uBPF.
+std::unique_ptr<execution_backend>
+create_ubpf_backend(bool jit);
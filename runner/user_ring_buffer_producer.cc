@@ -0,0 +1,130 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "user_ring_buffer_producer.h"
+
+#include "cpu_affinity.h"
+
+#include <bpf/bpf.h>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+user_ring_buffer_producer::user_ring_buffer_producer(
+    const bpf_object* obj, const user_ring_buffer_producer_parameters& parameters)
+    : parameters(parameters)
+{
+#if defined(__linux__) && defined(HAS_USER_RING_BUFFER)
+    if (parameters.record_size < sizeof(uint64_t)) {
+        throw std::runtime_error("Field user_ring_buffer_producer.record_size must be at least 8");
+    }
+    auto map = bpf_object__find_map_by_name(obj, parameters.map_name.c_str());
+    if (!map) {
+        throw std::runtime_error("Failed to find map " + parameters.map_name);
+    }
+    if (parameters.drained_count_map_name.has_value()) {
+        auto drained_count_map = bpf_object__find_map_by_name(obj, parameters.drained_count_map_name->c_str());
+        if (!drained_count_map) {
+            throw std::runtime_error("Failed to find map " + *parameters.drained_count_map_name);
+        }
+        if (bpf_map__type(drained_count_map) != BPF_MAP_TYPE_PERCPU_ARRAY ||
+            bpf_map__value_size(drained_count_map) < sizeof(uint64_t)) {
+            throw std::runtime_error("Map " + *parameters.drained_count_map_name + " is not a per CPU array of counts");
+        }
+        drained_count_map_fd = bpf_map__fd(drained_count_map);
+    }
+    user_ring_buffer = user_ring_buffer__new(bpf_map__fd(map), nullptr);
+    if (!user_ring_buffer) {
+        throw std::runtime_error("Failed to create user ring buffer producer for map " + parameters.map_name);
+    }
+#elif defined(__linux__)
+    throw std::runtime_error("User ring buffer producers require libbpf 1.1 or later");
+#else
+    throw std::runtime_error("User ring buffer producers are only supported on Linux");
+#endif
+}
+
+user_ring_buffer_producer::~user_ring_buffer_producer()
+{
+    if (thread.joinable()) {
+        thread.request_stop();
+        thread.join();
+    }
+#if defined(__linux__) && defined(HAS_USER_RING_BUFFER)
+    user_ring_buffer__free(user_ring_buffer);
+#endif
+}
+
+uint64_t
+user_ring_buffer_producer::read_drained_count() const
+{
+    int cpu_count = libbpf_num_possible_cpus();
+    std::vector<uint64_t> values(cpu_count);
+    int key = 0;
+    if (bpf_map_lookup_elem(drained_count_map_fd, &key, values.data()) < 0) {
+        throw std::runtime_error("Failed to read map " + *parameters.drained_count_map_name);
+    }
+    uint64_t total = 0;
+    for (auto value : values) {
+        total += value;
+    }
+    return total;
+}
+
+void
+user_ring_buffer_producer::start()
+{
+#if defined(__linux__) && defined(HAS_USER_RING_BUFFER)
+    result = user_ring_buffer_producer_result();
+    if (drained_count_map_fd >= 0) {
+        initial_drained_count = read_drained_count();
+    }
+    thread = std::jthread([this](std::stop_token stop_token) { run(stop_token); });
+#endif
+}
+
+user_ring_buffer_producer_result
+user_ring_buffer_producer::stop()
+{
+    thread.request_stop();
+    thread.join();
+    if (drained_count_map_fd >= 0) {
+        result.drained_count = read_drained_count() - initial_drained_count;
+    }
+    return result;
+}
+
+void
+user_ring_buffer_producer::run(std::stop_token stop_token)
+{
+#if defined(__linux__) && defined(HAS_USER_RING_BUFFER)
+    if (parameters.cpu.has_value()) {
+        (void)pin_current_thread_to_cpu(*parameters.cpu);
+    }
+
+    result.start_time = std::chrono::steady_clock::now();
+    result.end_time = result.start_time;
+    bool full = false;
+    while (!stop_token.stop_requested()) {
+        // A full ring buffer is retried until the programs drain it. The producer ends with the last record that it
+        // submitted before filling the ring buffer or being asked to stop.
+        void* record = user_ring_buffer__reserve(user_ring_buffer, parameters.record_size);
+        if (!record) {
+            if (!full) {
+                result.end_time = std::chrono::steady_clock::now();
+                full = true;
+            }
+            continue;
+        }
+        full = false;
+
+        // Each record starts with its sequence number.
+        uint64_t sequence_number = result.record_count++;
+        memcpy(record, &sequence_number, sizeof(sequence_number));
+        user_ring_buffer__submit(user_ring_buffer, record);
+    }
+    if (!full) {
+        result.end_time = std::chrono::steady_clock::now();
+    }
+#endif
+}
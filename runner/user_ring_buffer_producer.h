@@ -0,0 +1,68 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <bpf/libbpf.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <thread>
+
+// How a userspace producer fills a BPF_MAP_TYPE_USER_RINGBUF while the programs of a test drain it.
+struct user_ring_buffer_producer_parameters
+{
+    // Name of the user ring buffer map.
+    std::string map_name;
+    // Size of each record, which starts with its sequence number.
+    uint32_t record_size = 128;
+    // CPU to pin the producer to, if any.
+    std::optional<int> cpu;
+    // Name of a per CPU array whose first value counts the records drained by the programs, if any.
+    std::optional<std::string> drained_count_map_name;
+};
+
+// Records produced and drained while the producer was running.
+struct user_ring_buffer_producer_result
+{
+    uint64_t record_count = 0;
+    // Number of records drained by the programs, if the programs count them.
+    std::optional<uint64_t> drained_count;
+    // Time at which the producer started, and at which it submitted its last record.
+    std::chrono::steady_clock::time_point start_time;
+    std::chrono::steady_clock::time_point end_time;
+};
+
+// Userspace thread that produces records into a user ring buffer of a BPF object (Linux only).
+// libbpf doesn't synchronize concurrent producers of a user ring buffer, so there is a single producer thread.
+class user_ring_buffer_producer
+{
+  public:
+    user_ring_buffer_producer(const bpf_object* obj, const user_ring_buffer_producer_parameters& parameters);
+    ~user_ring_buffer_producer();
+
+    // Start producing records, which the programs drain.
+    void
+    start();
+
+    // Stop producing, and return what was produced and drained.
+    user_ring_buffer_producer_result
+    stop();
+
+  private:
+    // Sum of the per CPU values of the drained count map.
+    uint64_t
+    read_drained_count() const;
+
+    void
+    run(std::stop_token stop_token);
+
+    user_ring_buffer_producer_parameters parameters;
+    struct user_ring_buffer* user_ring_buffer = nullptr;
+    int drained_count_map_fd = -1;
+    uint64_t initial_drained_count = 0;
+    user_ring_buffer_producer_result result;
+    std::jthread thread;
+};
@@ -0,0 +1,208 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#include "userspace_benchmark.h"
+
+#include "map_state.h"
+
+#include <algorithm>
+#include <bpf/bpf.h>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+userspace_benchmark_result
+run_userspace_benchmark(const bpf_object* obj, const userspace_benchmark_parameters& parameters)
+{
+    auto map = bpf_object__find_map_by_name(obj, parameters.map_name.c_str());
+    if (!map) {
+        throw std::runtime_error("Failed to find map " + parameters.map_name);
+    }
+
+    const std::string& operation = parameters.operation;
+    bool is_batch = operation == "lookup_batch" || operation == "update_batch" || operation == "delete_batch";
+    bool is_mmap = operation == "mmap_read" || operation == "mmap_write";
+    if (!is_batch && !is_mmap && operation != "lookup" && operation != "update" && operation != "delete" &&
+        operation != "get_next_key" && operation != "iterate") {
+        throw std::runtime_error("Unknown userspace operation " + operation);
+    }
+#if !defined(HAS_BPF_MAP_BATCH_OPERATIONS)
+    if (is_batch) {
+        throw std::runtime_error("Userspace operation " + operation + " requires batch map operations");
+    }
+#endif
+    if (parameters.batch_size == 0) {
+        throw std::runtime_error("Field userspace.batch_size must be greater than zero");
+    }
+
+    int map_fd = bpf_map__fd(map);
+    size_t key_size = bpf_map__key_size(map);
+    size_t value_size = map_value_buffer_size(map);
+    uint32_t key_count = parameters.key_count ? parameters.key_count : bpf_map__max_entries(map);
+    uint32_t batch_size = is_batch ? parameters.batch_size : 1;
+
+    // Mapping of the values of a BPF_F_MMAPABLE array, each of which is 8 byte aligned.
+    uint8_t* mapping = nullptr;
+    size_t mapping_size = 0;
+    size_t mapping_value_size = (value_size + 7) & ~static_cast<size_t>(7);
+    if (is_mmap) {
+#if defined(__linux__)
+        if (bpf_map__type(map) != BPF_MAP_TYPE_ARRAY || !(bpf_map__map_flags(map) & BPF_F_MMAPABLE)) {
+            throw std::runtime_error("Map " + parameters.map_name + " is not a BPF_F_MMAPABLE array");
+        }
+        size_t page_size = sysconf(_SC_PAGESIZE);
+        mapping_size = (mapping_value_size * bpf_map__max_entries(map) + page_size - 1) / page_size * page_size;
+        void* address = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, map_fd, 0);
+        if (address == MAP_FAILED) {
+            throw std::runtime_error("Failed to mmap map " + parameters.map_name + ": " + strerror(errno));
+        }
+        mapping = static_cast<uint8_t*>(address);
+        key_count = std::min(key_count, bpf_map__max_entries(map));
+#else
+        throw std::runtime_error("Userspace operation " + operation + " is only supported on Linux");
+#endif
+    }
+
+    std::vector<uint8_t> keys(batch_size * key_size);
+    std::vector<uint8_t> values(batch_size * value_size);
+    std::vector<uint8_t> next_key(key_size);
+    // Position of the batch operations in the map, at least as large as the key.
+    std::vector<uint8_t> in_batch(std::max<size_t>(key_size, sizeof(uint64_t)));
+    std::vector<uint8_t> out_batch(in_batch.size());
+
+    // Store the next count keys (and values for updates) in the buffers, cycling through key_count keys.
+    uint32_t next = 0;
+    uint32_t current = 0;
+    auto store_keys = [&](uint32_t count) {
+        for (uint32_t i = 0; i < count; i++) {
+            current = next;
+            store_integer(keys.data() + i * key_size, key_size, next);
+            store_integer(values.data() + i * value_size, value_size, next);
+            next = next + 1 < key_count ? next + 1 : 0;
+        }
+    };
+
+    // Walks of the map (get_next_key, iterate and lookup_batch) start over when they reach the end, which fails if
+    // the map is empty.
+    bool walking = false;
+    uint64_t walk_element_count = 0;
+    auto start_over = [&]() {
+        if (walk_element_count == 0) {
+            throw std::runtime_error("Map " + parameters.map_name + " is empty");
+        }
+        walking = false;
+        walk_element_count = 0;
+    };
+
+#if defined(HAS_BPF_MAP_BATCH_OPERATIONS)
+    bpf_map_batch_opts opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.sz = sizeof(opts);
+#endif
+
+    userspace_benchmark_result result;
+    // Time spent restoring the map between operations, which isn't part of the measurement.
+    std::chrono::steady_clock::duration excluded_time{0};
+    auto start_time = std::chrono::steady_clock::now();
+    while (result.element_count < parameters.element_count) {
+        // Failures such as looking up or deleting a key that isn't in the map are part of the measurement.
+        if (operation == "lookup") {
+            store_keys(1);
+            (void)bpf_map_lookup_elem(map_fd, keys.data(), values.data());
+            result.element_count++;
+        } else if (operation == "update") {
+            store_keys(1);
+            (void)bpf_map_update_elem(map_fd, keys.data(), values.data(), BPF_ANY);
+            result.element_count++;
+        } else if (operation == "delete") {
+            store_keys(1);
+            (void)bpf_map_delete_elem(map_fd, keys.data());
+            result.element_count++;
+        } else if (operation == "mmap_read") {
+            // Copy the value out, as bpf_map_lookup_elem does.
+            store_keys(1);
+            memcpy(values.data(), mapping + current * mapping_value_size, value_size);
+            result.element_count++;
+        } else if (operation == "mmap_write") {
+            store_keys(1);
+            memcpy(mapping + current * mapping_value_size, values.data(), value_size);
+            result.element_count++;
+        } else if (operation == "get_next_key" || operation == "iterate") {
+            if (bpf_map_get_next_key(map_fd, walking ? keys.data() : nullptr, next_key.data()) < 0) {
+                start_over();
+                continue;
+            }
+            walking = true;
+            walk_element_count++;
+            std::copy(next_key.begin(), next_key.end(), keys.begin());
+            if (operation == "iterate") {
+                (void)bpf_map_lookup_elem(map_fd, keys.data(), values.data());
+            }
+            result.element_count++;
+        } else {
+#if defined(HAS_BPF_MAP_BATCH_OPERATIONS)
+            uint32_t count = batch_size;
+            if (operation == "lookup_batch") {
+                int error = bpf_map_lookup_batch(
+                    map_fd,
+                    walking ? in_batch.data() : nullptr,
+                    out_batch.data(),
+                    keys.data(),
+                    values.data(),
+                    &count,
+                    &opts);
+                if (error < 0 && errno != ENOENT) {
+                    throw std::runtime_error(
+                        "Failed to look up a batch of map " + parameters.map_name + ": " + strerror(errno));
+                }
+                walking = true;
+                walk_element_count += count;
+                result.element_count += count;
+                if (error < 0) {
+                    // The end of the map was reached.
+                    start_over();
+                } else {
+                    std::swap(in_batch, out_batch);
+                }
+            } else if (operation == "update_batch") {
+                store_keys(batch_size);
+                if (bpf_map_update_batch(map_fd, keys.data(), values.data(), &count, &opts) < 0) {
+                    throw std::runtime_error(
+                        "Failed to update a batch of map " + parameters.map_name + ": " + strerror(errno));
+                }
+                result.element_count += count;
+            } else {
+                // Batch deletes stop at the first key that isn't in the map, so re-create the keys first, outside of
+                // the measurement.
+                store_keys(batch_size);
+                auto refill_start = std::chrono::steady_clock::now();
+                if (bpf_map_update_batch(map_fd, keys.data(), values.data(), &count, &opts) < 0) {
+                    throw std::runtime_error(
+                        "Failed to update a batch of map " + parameters.map_name + ": " + strerror(errno));
+                }
+                excluded_time += std::chrono::steady_clock::now() - refill_start;
+                count = batch_size;
+                if (bpf_map_delete_batch(map_fd, keys.data(), &count, &opts) < 0) {
+                    throw std::runtime_error(
+                        "Failed to delete a batch of map " + parameters.map_name + ": " + strerror(errno));
+                }
+                result.element_count += count;
+            }
+#endif
+        }
+    }
+    result.duration = std::chrono::steady_clock::now() - start_time - excluded_time;
+
+#if defined(__linux__)
+    if (mapping) {
+        munmap(mapping, mapping_size);
+    }
+#endif
+    return result;
+}
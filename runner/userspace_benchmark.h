@@ -0,0 +1,46 @@
+// Copyright (c) Microsoft Corporation
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <bpf/libbpf.h>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Map operation issued from userspace by a test, as a control plane would.
+struct userspace_benchmark_parameters
+{
+    // Name of the map to operate on.
+    std::string map_name;
+    // One of:
+    // - lookup, update, delete: bpf_map_lookup_elem, bpf_map_update_elem or bpf_map_delete_elem on each key in turn.
+    // - get_next_key: walk the keys of the map with bpf_map_get_next_key, starting over at the end.
+    // - iterate: walk the map with bpf_map_get_next_key and read each element with bpf_map_lookup_elem.
+    // - lookup_batch: dump the map batch_size elements at a time with bpf_map_lookup_batch, starting over at the end.
+    // - update_batch, delete_batch: bpf_map_update_batch or bpf_map_delete_batch on batch_size keys at a time. The
+    //   keys of each delete_batch are re-created before it, outside of the measurement.
+    // - mmap_read, mmap_write: copy the value of each key in turn from or to a mapping of a BPF_F_MMAPABLE array
+    //   (Linux only).
+    std::string operation = "lookup";
+    // Number of keys cycled through, defaulting to the max_entries of the map. Keys are the little-endian integers
+    // 0, 1, 2, ..., as stored by the sequential generator of the map state preparation, and values hold their key.
+    uint32_t key_count = 0;
+    // Number of elements per batch operation.
+    uint32_t batch_size = 256;
+    // Number of elements to operate on.
+    uint64_t element_count = 0;
+};
+
+struct userspace_benchmark_result
+{
+    // Number of elements operated on.
+    uint64_t element_count = 0;
+    // Time taken by the operations, excluding the setup of the benchmark.
+    std::chrono::nanoseconds duration{0};
+};
+
+// Run the operation on the calling thread until element_count elements have been operated on.
+userspace_benchmark_result
+run_userspace_benchmark(const bpf_object* obj, const userspace_benchmark_parameters& parameters);